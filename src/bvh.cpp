@@ -0,0 +1,241 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+
+namespace {
+    struct Bounds {
+        glm::vec3 min = glm::vec3(FLT_MAX);
+        glm::vec3 max = glm::vec3(-FLT_MAX);
+
+        void grow(const glm::vec3& p) {
+            min = glm::min(min, p);
+            max = glm::max(max, p);
+        }
+        void grow(const Bounds& bounds) {
+            min = glm::min(min, bounds.min);
+            max = glm::max(max, bounds.max);
+        }
+        // Half the surface area, the heuristic only compares them
+        float area() const {
+            if (min.x > max.x)
+                return 0.0f;
+            glm::vec3 e = max - min;
+            return e.x * e.y + e.y * e.z + e.z * e.x;
+        }
+    };
+
+    // Traversal stack, deep enough for unbalanced splits of meshes with millions of triangles
+    const unsigned int TRAVERSAL_STACK_SIZE = 128;
+}
+
+bool intersectRayBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& origin, const glm::vec3& inverseDirection,
+    float tMax, float& tEntry)
+{
+    glm::vec3 t0 = (boundsMin - origin) * inverseDirection;
+    glm::vec3 t1 = (boundsMax - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return tEntry <= tExit;
+}
+
+BVH::BVH(std::vector<glm::vec3> positions, const std::vector<unsigned int>& indices) : positions(std::move(positions))
+{
+    unsigned int count = (unsigned int)(indices.size() / 3);
+    std::vector<glm::uvec3> unsorted(count);
+    std::vector<Bounds> triangleBounds(count);
+    std::vector<glm::vec3> centroids(count);
+    for (unsigned int i = 0; i < count; i++) {
+        unsorted[i] = glm::uvec3(indices[i * 3], indices[i * 3 + 1], indices[i * 3 + 2]);
+        triangleBounds[i].grow(this->positions[unsorted[i].x]);
+        triangleBounds[i].grow(this->positions[unsorted[i].y]);
+        triangleBounds[i].grow(this->positions[unsorted[i].z]);
+        centroids[i] = (triangleBounds[i].min + triangleBounds[i].max) * 0.5f;
+    }
+
+    std::vector<unsigned int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    nodes.reserve(count > 0 ? 2 * count : 1);
+    nodes.push_back(Node());
+
+    // Top down, the children of a node are created together so they are next to each other
+    struct Task {
+        unsigned int node, begin, end;
+    };
+    std::vector<Task> tasks = { { 0, 0, count } };
+    while (!tasks.empty()) {
+        Task task = tasks.back();
+        tasks.pop_back();
+
+        Bounds bounds, centroidBounds;
+        for (unsigned int i = task.begin; i < task.end; i++) {
+            bounds.grow(triangleBounds[order[i]]);
+            centroidBounds.grow(centroids[order[i]]);
+        }
+        unsigned int n = task.end - task.begin;
+
+        // Binned SAH, costs are in triangle intersections weighted by the area of the child
+        int bestAxis = -1;
+        unsigned int bestSplit = 0;
+        float bestCost = FLT_MAX;
+        for (int axis = 0; axis < 3 && n > BVH_MAX_LEAF_TRIANGLES; axis++) {
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if (extent <= 0.0f)
+                continue;
+            float binScale = BVH_SAH_BINS / extent;
+            Bounds bins[BVH_SAH_BINS];
+            unsigned int binCounts[BVH_SAH_BINS] = {};
+            for (unsigned int i = task.begin; i < task.end; i++) {
+                unsigned int bin = std::min((unsigned int)((centroids[order[i]][axis] - centroidBounds.min[axis]) * binScale), BVH_SAH_BINS - 1);
+                binCounts[bin]++;
+                bins[bin].grow(triangleBounds[order[i]]);
+            }
+
+            float leftAreas[BVH_SAH_BINS - 1];
+            unsigned int leftCounts[BVH_SAH_BINS - 1];
+            Bounds left;
+            unsigned int leftCount = 0;
+            for (unsigned int b = 0; b < BVH_SAH_BINS - 1; b++) {
+                left.grow(bins[b]);
+                leftCount += binCounts[b];
+                leftAreas[b] = left.area();
+                leftCounts[b] = leftCount;
+            }
+            Bounds right;
+            unsigned int rightCount = 0;
+            for (unsigned int b = BVH_SAH_BINS - 1; b > 0; b--) {
+                right.grow(bins[b]);
+                rightCount += binCounts[b];
+                float cost = leftCounts[b - 1] * leftAreas[b - 1] + rightCount * right.area();
+                if (leftCounts[b - 1] > 0 && rightCount > 0 && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        // Leaf when no split beats intersecting all of the node's triangles
+        if (bestAxis < 0 || bestCost >= n * bounds.area()) {
+            nodes[task.node] = { bounds.min, task.begin, bounds.max, n };
+            continue;
+        }
+
+        float binScale = BVH_SAH_BINS / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+        float axisMin = centroidBounds.min[bestAxis];
+        unsigned int mid = (unsigned int)(std::partition(order.begin() + task.begin, order.begin() + task.end, [&](unsigned int t) {
+            return std::min((unsigned int)((centroids[t][bestAxis] - axisMin) * binScale), BVH_SAH_BINS - 1) < bestSplit;
+        }) - order.begin());
+
+        unsigned int first = (unsigned int)nodes.size();
+        nodes[task.node] = { bounds.min, first, bounds.max, 0 };
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        tasks.push_back({ first, task.begin, mid });
+        tasks.push_back({ first + 1, mid, task.end });
+    }
+
+    triangles.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+        triangles[i] = unsorted[order[i]];
+}
+
+bool BVH::intersectTriangle(unsigned int triangle, const glm::vec3& origin, const glm::vec3& direction, float& t) const
+{
+    // Moeller-Trumbore, both sides
+    const glm::uvec3& tri = triangles[triangle];
+    const glm::vec3& v0 = positions[tri.x];
+    glm::vec3 edge1 = positions[tri.y] - v0;
+    glm::vec3 edge2 = positions[tri.z] - v0;
+    glm::vec3 p = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, p);
+    if (std::abs(determinant) < 1e-12f)
+        return false;
+    float inverseDeterminant = 1.0f / determinant;
+    glm::vec3 s = origin - v0;
+    float u = glm::dot(s, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+    float distance = glm::dot(edge2, q) * inverseDeterminant;
+    if (distance <= 0.0f || distance >= t)
+        return false;
+    t = distance;
+    return true;
+}
+
+template <bool anyHit>
+bool BVH::traverse(const glm::vec3& origin, const glm::vec3& direction, float& tMax, unsigned int& triangle) const
+{
+    if (triangles.empty())
+        return false;
+    glm::vec3 inverseDirection = 1.0f / direction;
+    float tEntry;
+    if (!intersectRayBounds(nodes[0].boundsMin, nodes[0].boundsMax, origin, inverseDirection, tMax, tEntry))
+        return false;
+
+    unsigned int stack[TRAVERSAL_STACK_SIZE];
+    unsigned int stackSize = 0;
+    unsigned int nodeIndex = 0;
+    bool hit = false;
+    while (true) {
+        const Node& node = nodes[nodeIndex];
+        if (node.count > 0) {
+            for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                if (this->intersectTriangle(i, origin, direction, tMax)) {
+                    hit = true;
+                    triangle = i;
+                    if (anyHit)
+                        return true;
+                }
+            }
+        }
+        else {
+            // Nearer child first, the other one is visited later if the ray still reaches it
+            unsigned int a = node.first, b = node.first + 1;
+            float tA, tB;
+            bool hitA = intersectRayBounds(nodes[a].boundsMin, nodes[a].boundsMax, origin, inverseDirection, tMax, tA);
+            bool hitB = intersectRayBounds(nodes[b].boundsMin, nodes[b].boundsMax, origin, inverseDirection, tMax, tB);
+            if (hitA && hitB) {
+                if (tB < tA)
+                    std::swap(a, b);
+                if (stackSize < TRAVERSAL_STACK_SIZE)
+                    stack[stackSize++] = b;
+                nodeIndex = a;
+                continue;
+            }
+            if (hitA || hitB) {
+                nodeIndex = hitA ? a : b;
+                continue;
+            }
+        }
+        if (stackSize == 0)
+            break;
+        nodeIndex = stack[--stackSize];
+    }
+    return hit;
+}
+
+bool BVH::intersect(const glm::vec3& origin, const glm::vec3& direction, float& tMax, unsigned int& triangle) const
+{
+    return this->traverse<false>(origin, direction, tMax, triangle);
+}
+
+bool BVH::occluded(const glm::vec3& origin, const glm::vec3& direction, float tMax) const
+{
+    unsigned int triangle;
+    return this->traverse<true>(origin, direction, tMax, triangle);
+}
+
+glm::vec3 BVH::getNormal(unsigned int triangle) const
+{
+    const glm::uvec3& tri = triangles[triangle];
+    return glm::cross(positions[tri.y] - positions[tri.x], positions[tri.z] - positions[tri.x]);
+}
@@ -0,0 +1,62 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Triangles per leaf below which nodes are not split any further
+const unsigned int BVH_MAX_LEAF_TRIANGLES = 4;
+// Centroid bins per axis for the surface area heuristic
+const unsigned int BVH_SAH_BINS = 12;
+
+// Slab test of a ray against an axis aligned box, tEntry is where it enters (0 if it starts inside)
+bool intersectRayBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& origin, const glm::vec3& inverseDirection,
+    float tMax, float& tEntry);
+
+// Bounding volume hierarchy over one mesh's triangles for ray queries on the CPU (e.g. baking).
+// Built with the binned surface area heuristic, immutable afterwards so any thread can trace it
+class BVH {
+private:
+    struct Node {
+        glm::vec3 boundsMin;
+        // Inner nodes: first child, the second follows it. Leaves: first triangle
+        unsigned int first;
+        glm::vec3 boundsMax;
+        // Triangles of a leaf, 0 for inner nodes
+        unsigned int count;
+    };
+
+    std::vector<glm::vec3> positions;
+    // Sorted so the triangles of every leaf are contiguous
+    std::vector<glm::uvec3> triangles;
+    std::vector<Node> nodes;
+
+    bool intersectTriangle(unsigned int triangle, const glm::vec3& origin, const glm::vec3& direction, float& t) const;
+    template <bool anyHit>
+    bool traverse(const glm::vec3& origin, const glm::vec3& direction, float& tMax, unsigned int& triangle) const;
+public:
+    // Indices are 3 per triangle
+    BVH(std::vector<glm::vec3> positions, const std::vector<unsigned int>& indices);
+
+    // Closest hit in (0, tMax), tMax becomes its distance. The direction does not have to be normalized,
+    // distances are in its length
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float& tMax, unsigned int& triangle) const;
+    // Any hit in (0, tMax), for shadow rays
+    bool occluded(const glm::vec3& origin, const glm::vec3& direction, float tMax) const;
+    // Unnormalized, facing the side the triangle is counter-clockwise from (the front face)
+    glm::vec3 getNormal(unsigned int triangle) const;
+
+    bool isEmpty() const {
+        return triangles.empty();
+    }
+    glm::vec3 getBoundsMin() const {
+        return nodes[0].boundsMin;
+    }
+    glm::vec3 getBoundsMax() const {
+        return nodes[0].boundsMax;
+    }
+};
+
+
+#endif
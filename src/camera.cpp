@@ -24,6 +24,12 @@ glm::mat4 Camera::GetViewMatrix()
     return glm::lookAt(Position, Position + Front, Up);
 }
 
+// returns the perspective projection matrix using the current zoom as vertical field of view
+glm::mat4 Camera::GetProjectionMatrix(float aspectRatio)
+{
+    return glm::perspective(glm::radians(Zoom), aspectRatio, NEAR_PLANE, FAR_PLANE);
+}
+
 // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 void Camera::ProcessKeyboard(CameraMovement direction, float deltaTime)
 {
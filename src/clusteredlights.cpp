@@ -0,0 +1,184 @@
+#include "clusteredlights.h"
+#include "jobsystem.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+
+ClusteredLights::ClusteredLights() : clusterMin(NUM_CLUSTERS), clusterMax(NUM_CLUSTERS), clusterRanges(NUM_CLUSTERS) {
+    glGenBuffers(1, &ssboClusterRanges);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboClusterRanges);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, NUM_CLUSTERS * sizeof(ClusterRange), NULL, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &ssboLightIndices);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+ClusteredLights::~ClusteredLights() {
+    glDeleteBuffers(1, &ssboClusterRanges);
+    glDeleteBuffers(1, &ssboLightIndices);
+}
+
+void ClusteredLights::update(const glm::mat4& projection, const glm::mat4& view, float nearPlane, float farPlane, const std::vector<PointLight>& pointLights) {
+    if (projection != this->projection || nearPlane != this->nearPlane || farPlane != this->farPlane) {
+        this->projection = projection;
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        this->buildClusters();
+    }
+
+    this->assignLights(view, pointLights);
+    this->uploadGlBuffers();
+}
+
+void ClusteredLights::bind(Shader& shader, unsigned int width, unsigned int height) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboClusterRanges);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ssboLightIndices);
+
+    // slice = log(depth) * scale - bias, inverse of the exponential split in buildClusters
+    float depthScale = GRID_Z / std::log(farPlane / nearPlane);
+    shader.setVec3("clusterGridSize", glm::vec3(GRID_X, GRID_Y, GRID_Z));
+    shader.setVec2("clusterTileSize", glm::vec2((float)width / GRID_X, (float)height / GRID_Y));
+    shader.setFloat("clusterDepthScale", depthScale);
+    shader.setFloat("clusterDepthBias", std::log(nearPlane) * depthScale);
+}
+
+void ClusteredLights::buildClusters() {
+    glm::mat4 invProjection = glm::inverse(projection);
+
+    for (unsigned int z = 0; z < GRID_Z; z++) {
+        // Exponential slices keep clusters roughly cubic along the depth
+        float sliceNear = nearPlane * std::pow(farPlane / nearPlane, (float)z / GRID_Z);
+        float sliceFar = nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / GRID_Z);
+
+        for (unsigned int y = 0; y < GRID_Y; y++) {
+            for (unsigned int x = 0; x < GRID_X; x++) {
+                glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+                for (unsigned int corner = 0; corner < 4; corner++) {
+                    glm::vec2 ndc = glm::vec2((float)(x + (corner & 1)) / GRID_X, (float)(y + (corner >> 1)) / GRID_Y) * 2.0f - 1.0f;
+                    // Point on the near plane, scaled along its view ray to both slice depths
+                    glm::vec4 point = invProjection * glm::vec4(ndc, -1.0f, 1.0f);
+                    glm::vec3 ray = glm::vec3(point) / point.w;
+                    ray /= -ray.z;
+
+                    boundsMin = glm::min(boundsMin, glm::min(ray * sliceNear, ray * sliceFar));
+                    boundsMax = glm::max(boundsMax, glm::max(ray * sliceNear, ray * sliceFar));
+                }
+
+                unsigned int cluster = x + GRID_X * (y + GRID_Y * z);
+                clusterMin[cluster] = boundsMin;
+                clusterMax[cluster] = boundsMax;
+            }
+        }
+    }
+}
+
+void ClusteredLights::assignLights(const glm::mat4& view, const std::vector<PointLight>& pointLights) {
+    viewLights.resize(pointLights.size());
+    for (unsigned int i = 0; i < pointLights.size(); i++) {
+        viewLights[i] = glm::vec4(glm::vec3(view * glm::vec4(pointLights[i].position, 1.0f)), pointLights[i].radius);
+    }
+
+    // Slices only write their own lists
+    JobSystem::instance().parallelFor(GRID_Z, 1, [this](unsigned int begin, unsigned int end) {
+        for (unsigned int slice = begin; slice < end; slice++) {
+            this->assignSlice(slice);
+        }
+    }, "assignClusterLights");
+
+    // Merge the slice lists, cluster offsets were relative to their slice
+    unsigned int total = 0;
+    for (unsigned int z = 0; z < GRID_Z; z++) {
+        for (unsigned int c = z * GRID_X * GRID_Y; c < (z + 1) * GRID_X * GRID_Y; c++) {
+            clusterRanges[c].offset += total;
+        }
+        total += slices[z].clusterLightIndices.size();
+    }
+    lightIndices.resize(total);
+    unsigned int offset = 0;
+    for (unsigned int z = 0; z < GRID_Z; z++) {
+        std::vector<unsigned int>& indices = slices[z].clusterLightIndices;
+        if (!indices.empty())
+            std::memcpy(&lightIndices[offset], indices.data(), indices.size() * sizeof(unsigned int));
+        offset += indices.size();
+    }
+}
+
+void ClusteredLights::assignSlice(unsigned int slice) {
+    SliceLights& lights = slices[slice];
+    lights.x.clear();
+    lights.y.clear();
+    lights.z.clear();
+    lights.radius2.clear();
+    lights.lightIndex.clear();
+    lights.clusterLightIndices.clear();
+
+    // View space z range of the slice (looking down -z)
+    unsigned int first = slice * GRID_X * GRID_Y;
+    float sliceMinZ = clusterMin[first].z;
+    float sliceMaxZ = clusterMax[first].z;
+    for (unsigned int i = 0; i < viewLights.size(); i++) {
+        const glm::vec4& light = viewLights[i];
+        if (light.z - light.w > sliceMaxZ || light.z + light.w < sliceMinZ)
+            continue;
+        lights.x.push_back(light.x);
+        lights.y.push_back(light.y);
+        lights.z.push_back(light.z);
+        lights.radius2.push_back(light.w * light.w);
+        lights.lightIndex.push_back(i);
+    }
+    // Padding never passes the test as the squared distance is never negative
+    while (lights.x.size() % 4 != 0) {
+        lights.x.push_back(0.0f);
+        lights.y.push_back(0.0f);
+        lights.z.push_back(0.0f);
+        lights.radius2.push_back(-1.0f);
+        lights.lightIndex.push_back(0);
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    for (unsigned int c = first; c < first + GRID_X * GRID_Y; c++) {
+        clusterRanges[c].offset = lights.clusterLightIndices.size();
+
+        const __m128 minX = _mm_set1_ps(clusterMin[c].x), maxX = _mm_set1_ps(clusterMax[c].x);
+        const __m128 minY = _mm_set1_ps(clusterMin[c].y), maxY = _mm_set1_ps(clusterMax[c].y);
+        const __m128 minZ = _mm_set1_ps(clusterMin[c].z), maxZ = _mm_set1_ps(clusterMax[c].z);
+        // Sphere against aabb, 4 lights at a time
+        for (unsigned int i = 0; i < lights.x.size(); i += 4) {
+            __m128 x = _mm_loadu_ps(&lights.x[i]);
+            __m128 y = _mm_loadu_ps(&lights.y[i]);
+            __m128 z = _mm_loadu_ps(&lights.z[i]);
+            // Distance from the center to the box per axis, 0 inside
+            __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+            __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+            __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+            __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+            int mask = _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_loadu_ps(&lights.radius2[i])));
+            for (unsigned int lane = 0; mask != 0; lane++, mask >>= 1) {
+                if (mask & 1)
+                    lights.clusterLightIndices.push_back(lights.lightIndex[i + lane]);
+            }
+        }
+
+        clusterRanges[c].count = lights.clusterLightIndices.size() - clusterRanges[c].offset;
+    }
+}
+
+void ClusteredLights::uploadGlBuffers() {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboClusterRanges);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, NUM_CLUSTERS * sizeof(ClusterRange), clusterRanges.data());
+
+    // Grow by doubling, at least one index so the buffer is never empty
+    unsigned int count = std::max((unsigned int)lightIndices.size(), 1u);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboLightIndices);
+    if (count > lightIndexCapacity) {
+        lightIndexCapacity = std::max(count, lightIndexCapacity * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, lightIndexCapacity * sizeof(unsigned int), NULL, GL_DYNAMIC_DRAW);
+    }
+    if (!lightIndices.empty())
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lightIndices.size() * sizeof(unsigned int), lightIndices.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
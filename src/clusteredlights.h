@@ -0,0 +1,69 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <glad/gl.h> 
+#include <glm/glm.hpp>
+
+#include "light.h"
+#include "shader.h"
+
+#include <vector>
+
+// Range in the light index list belonging to one cluster (std430 uvec2)
+struct ClusterRange {
+    unsigned int offset;
+    unsigned int count;
+};
+
+// View frustum split into a grid of clusters (screen tiles x exponential depth slices).
+// Point lights are assigned on the cpu to every cluster their radius overlaps,
+// so the forward shader only loops over the lights of the fragment's cluster.
+class ClusteredLights {
+public:
+    static const unsigned int GRID_X = 16, GRID_Y = 9, GRID_Z = 24;
+    static const unsigned int NUM_CLUSTERS = GRID_X * GRID_Y * GRID_Z;
+
+private:
+    // Lights overlapping one depth slice, structure of arrays padded to a multiple of 4 for SSE
+    struct SliceLights {
+        std::vector<float> x, y, z, radius2;
+        std::vector<unsigned int> lightIndex;
+        // Assigned light indices of all clusters in this slice
+        std::vector<unsigned int> clusterLightIndices;
+    };
+
+    // View space bounds of the clusters, only rebuilt when the projection changes
+    std::vector<glm::vec3> clusterMin, clusterMax;
+    glm::mat4 projection = glm::mat4(0.0f);
+    float nearPlane = 0.0f, farPlane = 0.0f;
+
+    // View space light spheres
+    std::vector<glm::vec4> viewLights;
+    SliceLights slices[GRID_Z];
+
+    std::vector<ClusterRange> clusterRanges;
+    std::vector<unsigned int> lightIndices;
+
+    unsigned int ssboClusterRanges;
+    unsigned int ssboLightIndices;
+    // Number of indices the light index ssbo can hold
+    unsigned int lightIndexCapacity = 0;
+
+public:
+    ClusteredLights();
+    ~ClusteredLights();
+
+    // Assign the lights for this frame's camera and upload the cluster lists
+    void update(const glm::mat4& projection, const glm::mat4& view, float nearPlane, float farPlane, const std::vector<PointLight>& pointLights);
+    // Bind the cluster buffers and grid uniforms for the forward shader
+    void bind(Shader& shader, unsigned int width, unsigned int height);
+
+private:
+    void buildClusters();
+    void assignLights(const glm::mat4& view, const std::vector<PointLight>& pointLights);
+    void assignSlice(unsigned int slice);
+    void uploadGlBuffers();
+};
+
+
+#endif
@@ -0,0 +1,35 @@
+#include "framepacket.h"
+
+#include <cstring>
+
+UiDrawData::~UiDrawData() {
+	for (ImDrawList* list : lists) {
+		IM_DELETE(list);
+	}
+}
+
+void UiDrawData::copy(const ImDrawData* source) {
+	while (lists.size() < (size_t)source->CmdListsCount) {
+		lists.push_back(IM_NEW(ImDrawList)(ImGui::GetDrawListSharedData()));
+	}
+
+	for (int i = 0; i < source->CmdListsCount; i++) {
+		const ImDrawList* sourceList = source->CmdLists[i];
+		ImDrawList* list = lists[i];
+		// resize keeps the capacity unlike ImVector assignment
+		list->CmdBuffer.resize(sourceList->CmdBuffer.Size);
+		list->IdxBuffer.resize(sourceList->IdxBuffer.Size);
+		list->VtxBuffer.resize(sourceList->VtxBuffer.Size);
+		std::memcpy(list->CmdBuffer.Data, sourceList->CmdBuffer.Data, sourceList->CmdBuffer.size_in_bytes());
+		std::memcpy(list->IdxBuffer.Data, sourceList->IdxBuffer.Data, sourceList->IdxBuffer.size_in_bytes());
+		std::memcpy(list->VtxBuffer.Data, sourceList->VtxBuffer.Data, sourceList->VtxBuffer.size_in_bytes());
+		list->Flags = sourceList->Flags;
+	}
+
+	drawData = *source;
+	drawData.CmdLists = lists.data();
+}
+
+ImDrawData* UiDrawData::getDrawData() {
+	return &drawData;
+}
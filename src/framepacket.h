@@ -0,0 +1,77 @@
+#ifndef FRAME_PACKET_H
+#define FRAME_PACKET_H
+
+#include <glm/glm.hpp>
+
+#include "imgui/imgui.h"
+
+#include "camera.h"
+#include "renderer.h"
+
+#include <vector>
+
+
+// Copy of the ImGui draw data, buffers are reused between frames to avoid reallocating
+class UiDrawData {
+private:
+	std::vector<ImDrawList*> lists;
+	ImDrawData drawData;
+public:
+	~UiDrawData();
+
+	void copy(const ImDrawData* source);
+	ImDrawData* getDrawData();
+};
+
+// Options set through the UI, applied by the render thread
+struct RenderSettings {
+	RenderType renderType = RenderType::FORWARD;
+	float gamma = 2.2f;
+	float exposure = 1.0f;
+	glm::mat3 kernel = glm::mat3(
+		0, 0, 0,
+		0, 1, 0,
+		0, 0, 0
+	);
+	bool visualizeNormals = false;
+
+	// testing pbr
+	float metallic = 0.0f;
+	float roughness = 0.025f;
+	float ao = 1.0f;
+
+	glm::vec3 lightPosition = glm::vec3(0.5f, 0.25f, 0.875f);
+	int numCascades = 4;
+	ShadowQuality shadowQuality = SHADOW_POISSON_8;
+	float pointShadowBudget = POINT_SHADOW_BUDGET_MS;
+
+	// light culling
+	int numTestLights = 0;
+	bool lightHeatmap = false;
+
+	// Index into ENVIRONMENT_PATHS
+	int environment = 0;
+};
+
+// Everything the render thread needs for one frame, written by the main thread only
+// before submitting and read by the render thread only after receiving it.
+// Stats go the other way, the render thread fills them in before releasing the packet.
+struct FramePacket {
+	Camera camera;
+	// Framebuffer size
+	int width, height;
+	RenderSettings settings;
+
+	// Scene items that passed frustum culling
+	std::vector<unsigned int> visibleItems;
+
+	UiDrawData ui;
+
+	// Point shadow updates of the frame rendered with this packet
+	ShadowUpdateStats shadowStats;
+	// Uniform updates of that frame
+	UniformStats uniformStats;
+};
+
+
+#endif
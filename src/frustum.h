@@ -0,0 +1,29 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// Frustum planes from the rows of the view projection matrix (Gribb-Hartmann)
+inline void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+    glm::mat4 m = glm::transpose(viewProjection);
+    planes[0] = m[3] + m[0];
+    planes[1] = m[3] - m[0];
+    planes[2] = m[3] + m[1];
+    planes[3] = m[3] - m[1];
+    planes[4] = m[3] + m[2];
+    planes[5] = m[3] - m[2];
+}
+
+inline bool isBoxInFrustum(const glm::vec4 planes[6], const glm::vec3& center, const glm::vec3& extents) {
+    for (unsigned int i = 0; i < 6; i++) {
+        glm::vec3 normal(planes[i]);
+        // Distance of the box corner furthest along the plane normal
+        float distance = glm::dot(normal, center) + glm::dot(glm::abs(normal), extents) + planes[i].w;
+        if (distance < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+
+#endif
@@ -0,0 +1,44 @@
+#include "gputimer.h"
+
+GpuTimer::GpuTimer() {
+    glGenQueries(NUM_QUERIES, queries);
+}
+
+GpuTimer::~GpuTimer() {
+    glDeleteQueries(NUM_QUERIES, queries);
+}
+
+bool GpuTimer::begin() {
+    if (pending == NUM_QUERIES)
+        return false;
+
+    glBeginQuery(GL_TIME_ELAPSED, queries[(first + pending) % NUM_QUERIES]);
+    active = true;
+    return true;
+}
+
+void GpuTimer::end() {
+    if (!active)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    active = false;
+    pending++;
+}
+
+bool GpuTimer::getResult(double& milliseconds) {
+    if (pending == 0)
+        return false;
+
+    int available = 0;
+    glGetQueryObjectiv(queries[first], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return false;
+
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(queries[first], GL_QUERY_RESULT, &nanoseconds);
+    milliseconds = nanoseconds / 1000000.0;
+    first = (first + 1) % NUM_QUERIES;
+    pending--;
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/gl.h> 
+
+// GL_TIME_ELAPSED queries in a small ring, results are read a few frames later so the
+// CPU never waits for the GPU
+class GpuTimer {
+private:
+    static const unsigned int NUM_QUERIES = 4;
+
+    unsigned int queries[NUM_QUERIES];
+    // Oldest query without a read result and the number of those
+    unsigned int first = 0;
+    unsigned int pending = 0;
+    bool active = false;
+
+public:
+    GpuTimer();
+    ~GpuTimer();
+
+    // Returns false (and measures nothing) while all queries are waiting for results
+    bool begin();
+    void end();
+    // Oldest finished measurement, in the order begin() was called
+    bool getResult(double& milliseconds);
+};
+
+
+#endif
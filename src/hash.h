@@ -0,0 +1,20 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+
+// FNV-1a, 64 bit so keys of different inputs don't collide. Chain calls starting from HASH_SEED
+const unsigned long long HASH_SEED = 14695981039346656037ull;
+
+inline unsigned long long hashBytes(unsigned long long hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+#endif
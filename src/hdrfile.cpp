@@ -0,0 +1,318 @@
+#include "hdrfile.h"
+#include "jobsystem.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // Scanlines of 8 to 32767 pixels may use the run length encoding of newer files
+    const unsigned int MIN_RLE_WIDTH = 8;
+    const unsigned int MAX_RLE_WIDTH = 0x7fff;
+
+    // Decodes one scanline into rgbe (width * 4 bytes) or only checks it if rgbe is null.
+    // Returns the start of the next scanline, null if it is broken or uses old style run lengths
+    const unsigned char* readScanline(const unsigned char* p, const unsigned char* end, unsigned int width, unsigned char* rgbe)
+    {
+        bool rle = width >= MIN_RLE_WIDTH && width <= MAX_RLE_WIDTH && end - p >= 4
+            && p[0] == 2 && p[1] == 2 && ((unsigned int)p[2] << 8 | p[3]) == width;
+        if (!rle) {
+            if ((size_t)(end - p) < (size_t)width * 4)
+                return nullptr;
+            for (unsigned int x = 0; x < width; x++) {
+                // (1, 1, 1, n) repeats the previous pixel in old files
+                if (p[x * 4] == 1 && p[x * 4 + 1] == 1 && p[x * 4 + 2] == 1)
+                    return nullptr;
+            }
+            if (rgbe)
+                std::memcpy(rgbe, p, (size_t)width * 4);
+            return p + (size_t)width * 4;
+        }
+
+        // Every channel is encoded on its own, as runs (count > 128) and literal spans
+        p += 4;
+        for (unsigned int channel = 0; channel < 4; channel++) {
+            unsigned int x = 0;
+            while (x < width) {
+                if (p >= end)
+                    return nullptr;
+                unsigned int count = *p++;
+                if (count > 128) {
+                    count -= 128;
+                    if (x + count > width || p >= end)
+                        return nullptr;
+                    if (rgbe) {
+                        for (unsigned int i = 0; i < count; i++)
+                            rgbe[(x + i) * 4 + channel] = *p;
+                    }
+                    p++;
+                }
+                else {
+                    if (count == 0 || x + count > width || (size_t)(end - p) < count)
+                        return nullptr;
+                    if (rgbe) {
+                        for (unsigned int i = 0; i < count; i++)
+                            rgbe[(x + i) * 4 + channel] = p[i];
+                    }
+                    p += count;
+                }
+                x += count;
+            }
+        }
+        return p;
+    }
+
+    // Mantissas are (m + 0.5) / 256 * 2^(e - 128) in the format, stb_image leaves out the 0.5, so do we.
+    // As 9 bit mantissas that is (2m) * 2^(e - 137), which makes the RGB9E5 exponent e - 113
+    unsigned int rgbeToRGB9E5(const unsigned char* rgbe)
+    {
+        if (rgbe[3] == 0)
+            return 0;
+        int exponent = (int)rgbe[3] - 113;
+        if (exponent > 31) {
+            float scale = std::ldexp(1.0f, (int)rgbe[3] - 136);
+            return packRGB9E5(rgbe[0] * scale, rgbe[1] * scale, rgbe[2] * scale);
+        }
+
+        unsigned int shift = exponent < 0 ? (unsigned int)-exponent : 0;
+        if (shift > 9)
+            return 0;
+        unsigned int r = ((unsigned int)rgbe[0] << 1) >> shift;
+        unsigned int g = ((unsigned int)rgbe[1] << 1) >> shift;
+        unsigned int b = ((unsigned int)rgbe[2] << 1) >> shift;
+        return (unsigned int)std::max(exponent, 0) << 27 | b << 18 | g << 9 | r;
+    }
+
+    void rgbeToFloat(const unsigned char* rgbe, float* rgb)
+    {
+        float scale = rgbe[3] == 0 ? 0.0f : std::ldexp(1.0f, (int)rgbe[3] - 136);
+        rgb[0] = rgbe[0] * scale;
+        rgb[1] = rgbe[1] * scale;
+        rgb[2] = rgbe[2] * scale;
+    }
+}
+
+unsigned int packRGB9E5(float r, float g, float b)
+{
+    // 511/512 * 2^16
+    const float maxValue = 65408.0f;
+    r = std::min(std::max(r, 0.0f), maxValue);
+    g = std::min(std::max(g, 0.0f), maxValue);
+    b = std::min(std::max(b, 0.0f), maxValue);
+    float maxChannel = std::max(r, std::max(g, b));
+    if (maxChannel <= 0.0f)
+        return 0;
+
+    // Shared exponent with a bias of 15, so the largest mantissa fits 9 bits
+    int exponent;
+    std::frexp(maxChannel, &exponent);
+    exponent = std::max(exponent, -15) + 15;
+    float scale = std::ldexp(1.0f, 24 - exponent);
+    if ((unsigned int)(maxChannel * scale + 0.5f) == 512) {
+        exponent++;
+        scale *= 0.5f;
+    }
+    unsigned int rm = (unsigned int)(r * scale + 0.5f);
+    unsigned int gm = (unsigned int)(g * scale + 0.5f);
+    unsigned int bm = (unsigned int)(b * scale + 0.5f);
+    return (unsigned int)exponent << 27 | bm << 18 | gm << 9 | rm;
+}
+
+HDRFile::~HDRFile()
+{
+    this->close();
+}
+
+bool HDRFile::open(const std::string& path)
+{
+    this->close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    fileHandle = file;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        this->close();
+        return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+    mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle)
+        data = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        size = (size_t)info.st_size;
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+            data = (const unsigned char*)mapping;
+    }
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+#endif
+    if (!data) {
+        this->close();
+        return false;
+    }
+
+    if (!this->parseHeader()) {
+        // Other formats stb_image can read
+        int w, h, components;
+        if (size > (size_t)INT_MAX || !stbi_info_from_memory(data, (int)size, &w, &h, &components)) {
+            this->close();
+            return false;
+        }
+        width = w;
+        height = h;
+        pixelOffset = 0;
+    }
+    return true;
+}
+
+void HDRFile::close()
+{
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    if (data)
+        munmap((void*)data, size);
+#endif
+    data = nullptr;
+    size = 0;
+    width = height = 0;
+}
+
+bool HDRFile::parseHeader()
+{
+    if (size < 2 || data[0] != '#' || data[1] != '?')
+        return false;
+
+    // Lines of variables up to an empty one, then the resolution
+    const char* text = (const char*)data;
+    size_t position = 0;
+    while (true) {
+        const char* lineEnd = (const char*)std::memchr(text + position, '\n', size - position);
+        if (!lineEnd)
+            return false;
+        std::string line(text + position, lineEnd);
+        position = lineEnd - text + 1;
+        if (line.empty())
+            break;
+        if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe")
+            return false;
+    }
+
+    const char* lineEnd = (const char*)std::memchr(text + position, '\n', size - position);
+    if (!lineEnd)
+        return false;
+    std::string resolution(text + position, lineEnd);
+    char ySign, xSign;
+    int h, w;
+    // Only rows of +X pixels, -Y (top row first) is what every common tool writes
+    if (std::sscanf(resolution.c_str(), "%cY %d %cX %d", &ySign, &h, &xSign, &w) != 4 || xSign != '+'
+        || (ySign != '-' && ySign != '+') || w <= 0 || h <= 0)
+        return false;
+
+    width = w;
+    height = h;
+    topDown = ySign == '-';
+    pixelOffset = lineEnd - text + 1;
+    return true;
+}
+
+bool HDRFile::findScanlines(std::vector<const unsigned char*>& scanlines) const
+{
+    // Only skips over the runs, the decoding is done in parallel from these
+    const unsigned char* end = data + size;
+    const unsigned char* p = data + pixelOffset;
+    scanlines.resize(height + 1);
+    for (unsigned int i = 0; i < height; i++) {
+        scanlines[i] = p;
+        p = readScanline(p, end, width, nullptr);
+        if (!p)
+            return false;
+    }
+    scanlines[height] = p;
+    return true;
+}
+
+bool HDRFile::decode(std::vector<unsigned int>& pixels, const HDRRowCallback& rowCallback) const
+{
+    if (!data)
+        return false;
+
+    std::vector<const unsigned char*> scanlines;
+    if (pixelOffset == 0 || !this->findScanlines(scanlines))
+        return this->decodeFallback(pixels, rowCallback);
+
+    pixels.resize((size_t)width * height);
+    JobSystem::instance().parallelFor(height, 16, [&](unsigned int begin, unsigned int end) {
+        std::vector<unsigned char> rgbe((size_t)width * 4);
+        std::vector<float> row(rowCallback ? (size_t)width * 3 : 0);
+        for (unsigned int i = begin; i < end; i++) {
+            // Checked by findScanlines
+            readScanline(scanlines[i], scanlines[i + 1], width, rgbe.data());
+            unsigned int y = topDown ? height - 1 - i : i;
+            unsigned int* out = pixels.data() + (size_t)y * width;
+            for (unsigned int x = 0; x < width; x++)
+                out[x] = rgbeToRGB9E5(&rgbe[x * 4]);
+            if (rowCallback) {
+                for (unsigned int x = 0; x < width; x++)
+                    rgbeToFloat(&rgbe[x * 4], &row[x * 3]);
+                rowCallback(y, row.data());
+            }
+        }
+    }, "decodeHDR");
+    return true;
+}
+
+bool HDRFile::decodeFallback(std::vector<unsigned int>& pixels, const HDRRowCallback& rowCallback) const
+{
+    // From memory and without stbi_set_flip_vertically_on_load, that setting is global
+    int w, h, components;
+    float* floats = size > (size_t)INT_MAX ? nullptr : stbi_loadf_from_memory(data, (int)size, &w, &h, &components, 3);
+    if (!floats)
+        return false;
+
+    // Top row first
+    pixels.resize((size_t)w * h);
+    JobSystem::instance().parallelFor(h, 16, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            unsigned int y = h - 1 - i;
+            const float* row = floats + (size_t)i * w * 3;
+            unsigned int* out = pixels.data() + (size_t)y * w;
+            for (int x = 0; x < w; x++)
+                out[x] = packRGB9E5(row[x * 3], row[x * 3 + 1], row[x * 3 + 2]);
+            if (rowCallback)
+                rowCallback(y, row);
+        }
+    }, "decodeHDRFallback");
+    stbi_image_free(floats);
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef HDR_FILE_H
+#define HDR_FILE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Called from the job system's threads with every decoded row as RGB floats, y counts from the bottom
+typedef std::function<void(unsigned int y, const float* row)> HDRRowCallback;
+
+// Radiance RGBE (.hdr) image, memory mapped and decoded to RGB9E5 (GL_RGB9_E5 with GL_UNSIGNED_INT_5_9_9_9_REV).
+// Both have a shared exponent, so the conversion is exact and a third of the size of RGB floats.
+// Files with old style run lengths or another orientation are decoded with stb_image instead
+class HDRFile {
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+    unsigned int width = 0, height = 0;
+    // Offset of the first scanline, 0 for stb_image
+    size_t pixelOffset = 0;
+    // First scanline is the top one (-Y)
+    bool topDown = true;
+
+    bool parseHeader();
+    // Start of every scanline, they have different lengths with run length encoding
+    bool findScanlines(std::vector<const unsigned char*>& scanlines) const;
+    bool decodeFallback(std::vector<unsigned int>& pixels, const HDRRowCallback& rowCallback) const;
+    void close();
+public:
+    HDRFile() = default;
+    HDRFile(const HDRFile&) = delete;
+    HDRFile& operator=(const HDRFile&) = delete;
+    ~HDRFile();
+
+    // Maps the file and reads the header, false if it can't be read or is no image
+    bool open(const std::string& path);
+    // Decodes the scanlines in parallel, bottom row first as GL expects
+    bool decode(std::vector<unsigned int>& pixels, const HDRRowCallback& rowCallback = HDRRowCallback()) const;
+
+    unsigned int getWidth() const {
+        return width;
+    }
+    unsigned int getHeight() const {
+        return height;
+    }
+    // The mapped file
+    const unsigned char* getData() const {
+        return data;
+    }
+    size_t getSize() const {
+        return size;
+    }
+};
+
+// Packs a linear RGB color, negative values are clamped to 0 and large ones to the largest RGB9E5 value
+unsigned int packRGB9E5(float r, float g, float b);
+
+
+#endif
@@ -1,19 +1,47 @@
 #include "irradiancemap.h"
+#include "hash.h"
+
+#include <cassert>
+#include <cfloat>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+// Levels of a full mip chain, glGenerateMipmap allocates all of them
+static unsigned int mipLevelCount(unsigned int size) {
+    unsigned int levels = 1;
+    while (size >>= 1)
+        levels++;
+    return levels;
+}
+
+static void setCubemapParameters(unsigned int cubemap, GLenum minFilter) {
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
 
 IrradianceMap::IrradianceMap() {
     this->setupFrameBuffer();
-    this->generateCubemapTexture();
+#ifndef NDEBUG
+    // Once per run, the projection and all evaluations have to agree on the basis
+    static const bool shRoundTrip = checkSHRoundTrip();
+    assert(shRoundTrip);
+#endif
 }
 
 IrradianceMap::IrradianceMap(std::string filepath) : IrradianceMap() {
-    this->loadHDRToCubemap(filepath);
-    this->precompute();
+    this->startLoading(filepath);
+    this->finishLoading();
 }
 
 IrradianceMap::~IrradianceMap() {
     glDeleteFramebuffers(1, &captureFBO);
+    glDeleteTextures(1, &hdrTexture);
     glDeleteTextures(1, &envCubemap);
-    glDeleteTextures(1, &irradianceMap);
     glDeleteTextures(1, &prefilterMap);
     glDeleteTextures(1, &brdfLUT);
     glDeleteRenderbuffers(1, &captureRBO);
@@ -25,191 +53,310 @@ void IrradianceMap::setupFrameBuffer() {
 
     glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
     glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 
 void IrradianceMap::generateCubemapTexture() {
     glGenTextures(1, &envCubemap);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        // note that we store each face with 16 bit floating point values
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
-            512, 512, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // note that we store each face with 16 bit floating point values
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, mipLevelCount(ENVIRONMENT_SIZE), GL_RGBA16F, ENVIRONMENT_SIZE, ENVIRONMENT_SIZE);
+    setCubemapParameters(envCubemap, GL_LINEAR_MIPMAP_LINEAR);
 }
 
+void IrradianceMap::startLoading(const std::string& filepath) {
+    path = filepath;
+    loadStage = LoadStage::DECODING;
+    decoded = std::make_shared<DecodedEnvironment>();
+    // The job keeps its own reference, the map may be destroyed before it is done
+    std::shared_ptr<DecodedEnvironment> environment = decoded;
+    std::string cachePath = cache_path;
+    // Background like the file hash and the parallel row decode it runs, the frame's waits never pick them up
+    decodeJob = JobSystem::instance().schedule("decode environment", [environment, filepath, cachePath]() {
+        decode(*environment, filepath, cachePath);
+    }, nullptr, JOB_PRIORITY_BACKGROUND);
+
+    // Compile while the HDR is decoded
+    equirectangularToCubemapShader.submit();
+    prefilterShader.submit();
+    brdfShader.submit();
+}
 
-void IrradianceMap::loadHDRToCubemap(std::string filepath) {
-    stbi_set_flip_vertically_on_load(true);
-    int width, height, nrComponents;
-    float* data = stbi_loadf(filepath.c_str(), &width, &height, &nrComponents, 0);
-    unsigned int hdrTexture;
+bool IrradianceMap::continueLoading(float budgetMs) {
+    // Query results arrive a few frames late, keep a running cost per unit
+    double milliseconds;
+    while (loadTimer.getResult(milliseconds)) {
+        double units = timedUnits.front();
+        timedUnits.pop_front();
+        if (units > 0.0)
+            msPerUnit = glm::mix(msPerUnit, (float)(milliseconds / units), 0.25f);
+    }
 
-    if (!data) {
-        std::cerr << "Failed to load HDR image." << std::endl;
+    bool timing = loadTimer.begin();
+    double units = 0.0;
+    while (!isLoaded() && !hasFailed()) {
+        // Negative while waiting for the decode job or the readback
+        double stepUnits = this->loadStep();
+        if (stepUnits < 0.0)
+            break;
+        units += stepUnits;
+        if (units * msPerUnit >= budgetMs)
+            break;
     }
-    glGenTextures(1, &hdrTexture);
-    glBindTexture(GL_TEXTURE_2D, hdrTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data);
+    if (timing) {
+        loadTimer.end();
+        timedUnits.push_back(units);
+    }
+    return isLoaded();
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+void IrradianceMap::finishLoading() {
+    if (decodeJob)
+        JobSystem::instance().wait(decodeJob);
+    while (!isLoaded() && !hasFailed())
+        this->continueLoading(FLT_MAX);
+}
+
+double IrradianceMap::loadStep() {
+    switch (loadStage) {
+    case LoadStage::DECODING:
+        if (!JobSystem::instance().isFinished(decodeJob))
+            return -1.0;
+        decodeJob = nullptr;
+        if (decoded->failed) {
+            std::cerr << "Failed to load HDR image: " << path << std::endl;
+            decoded.reset();
+            loadStage = LoadStage::FAILED;
+            return -1.0;
+        }
+        irradianceSH = decoded->irradianceSH;
+        loadStage = decoded->cached ? LoadStage::UPLOAD_CACHED : LoadStage::UPLOAD_HDR;
+        return 0.0;
+    case LoadStage::UPLOAD_CACHED:
+        this->uploadCachedMaps();
+        loadStage = LoadStage::BRDF_LUT;
+        return 6.0 * ENVIRONMENT_SIZE * ENVIRONMENT_SIZE;
+    case LoadStage::UPLOAD_HDR:
+        return this->uploadHDRRows();
+    case LoadStage::CONVERT:
+        this->convertToCubemap();
+        loadStage = LoadStage::PREFILTER;
+        return 6.0 * ENVIRONMENT_SIZE * ENVIRONMENT_SIZE;
+    case LoadStage::PREFILTER: {
+        unsigned int level = prefilterLevel++;
+        this->prefilterLevelStep(level);
+        if (prefilterLevel == PREFILTER_MIP_LEVELS)
+            loadStage = LoadStage::BRDF_LUT;
+        unsigned int mipSize = PREFILTER_SIZE >> level;
+        return 6.0 * mipSize * mipSize * PREFILTER_SAMPLE_COUNTS[level];
+    }
+    case LoadStage::BRDF_LUT:
+        this->computeBrdfLUT();
+        if (decoded->cached) {
+            decoded.reset();
+            loadStage = LoadStage::COMPLETE;
+        }
+        else {
+            environmentReadback.start(GL_TEXTURE_CUBE_MAP, envCubemap, GL_RGB, mipLevelCount(ENVIRONMENT_SIZE));
+            prefilterReadback.start(GL_TEXTURE_CUBE_MAP, prefilterMap, GL_RGB, PREFILTER_MIP_LEVELS);
+            loadStage = LoadStage::READBACK;
+        }
+        return (double)BRDF_LUT_SIZE * BRDF_LUT_SIZE;
+    case LoadStage::READBACK:
+        if (!this->saveCachedMaps())
+            return -1.0;
+        decoded.reset();
+        loadStage = LoadStage::COMPLETE;
+        return 0.0;
+    default:
+        return -1.0;
+    }
+}
 
-    stbi_image_free(data);
+void IrradianceMap::decode(DecodedEnvironment& environment, const std::string& filepath, const std::string& cachePath) {
+    HDRFile file;
+    if (!file.open(filepath)) {
+        environment.failed = true;
+        return;
+    }
 
-    // convert HDR equirectangular environment map to cubemap equivalent
-    equirectangularToCubemapShader.use();
-    equirectangularToCubemapShader.setInt("equirectangularMap", 0);
-    equirectangularToCubemapShader.setMat4("projection", skybox.getProjectionMatrix());
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    environment.key = environmentKey(file.getData(), file.getSize());
+    char prefix[32];
+    std::snprintf(prefix, sizeof(prefix), "%016llx", environment.key);
+    // Key followed by the coefficients
+    std::ifstream shFile(cachePath + prefix + "_irradiance.sh", std::ios::binary);
+    unsigned long long shKey = 0;
+    if (shFile.read((char*)&shKey, sizeof(shKey)) && shKey == environment.key
+        && shFile.read((char*)environment.irradianceSH.coefficients, sizeof(environment.irradianceSH.coefficients))
+        && readKtx(cachePath + prefix + "_environment.ktx", GL_TEXTURE_CUBE_MAP, environment.key, environment.environment)
+        && readKtx(cachePath + prefix + "_prefilter.ktx", GL_TEXTURE_CUBE_MAP, environment.key, environment.prefilter)) {
+        environment.cached = true;
+        return;
+    }
 
-    glViewport(0, 0, 512, 512); // don't forget to configure the viewport to the capture dimensions.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        equirectangularToCubemapShader.setMat4("view", skybox.getViewMatrix(i));
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        skybox.draw(equirectangularToCubemapShader); // renders a 1x1 cube
+    // Straight from the decoded rows, no convolution pass on the GPU
+    IrradianceSHProjector projector(file.getWidth(), file.getHeight());
+    if (!file.decode(environment.pixels, [&projector](unsigned int y, const float* row) { projector.addRow(y, row); })) {
+        environment.failed = true;
+        return;
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    environment.irradianceSH = projector.getIrradiance();
+    environment.width = file.getWidth();
+    environment.height = file.getHeight();
+}
+
+void IrradianceMap::uploadCachedMaps() {
+    glGenTextures(1, &envCubemap);
+    glGenTextures(1, &prefilterMap);
+    uploadKtx(decoded->environment, GL_TEXTURE_CUBE_MAP, envCubemap);
+    uploadKtx(decoded->prefilter, GL_TEXTURE_CUBE_MAP, prefilterMap);
+    setCubemapParameters(envCubemap, GL_LINEAR_MIPMAP_LINEAR);
+    setCubemapParameters(prefilterMap, GL_LINEAR_MIPMAP_LINEAR);
 }
 
-void IrradianceMap::convoluteIrradianceMap() {
-    glGenTextures(1, &irradianceMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0,
-            GL_RGB, GL_FLOAT, nullptr);
+unsigned int IrradianceMap::uploadHDRRows() {
+    if (!hdrTexture) {
+        glGenTextures(1, &hdrTexture);
+        glBindTexture(GL_TEXTURE_2D, hdrTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB9_E5, decoded->width, decoded->height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
+    unsigned int rows = glm::clamp(HDR_UPLOAD_BYTES / (decoded->width * 4), 1u, decoded->height - uploadedRows);
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, uploadedRows, decoded->width, rows, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV,
+        decoded->pixels.data() + (size_t)uploadedRows * decoded->width);
+    uploadedRows += rows;
+    if (uploadedRows == decoded->height) {
+        std::vector<unsigned int>().swap(decoded->pixels);
+        loadStage = LoadStage::CONVERT;
+    }
+    return rows * decoded->width;
+}
 
-    irradianceShader.use();
-    irradianceShader.setInt("environmentMap", 0);
-    irradianceShader.setMat4("projection", skybox.getProjectionMatrix());
+void IrradianceMap::convertToCubemap() {
+    // convert HDR equirectangular environment map to cubemap equivalent, all faces in one dispatch
+    this->generateCubemapTexture();
+    equirectangularToCubemapShader.use();
+    equirectangularToCubemapShader.setInt("equirectangularMap", 0);
     glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    glBindImageTexture(0, envCubemap, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    unsigned int groups = (ENVIRONMENT_SIZE + 7) / 8;
+    glDispatchCompute(groups, groups, 6);
+    // Mips for the filtered importance sampling of the prefilter pass
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-    glViewport(0, 0, 32, 32); // don't forget to configure the viewport to the capture dimensions.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        irradianceShader.setMat4("view", skybox.getViewMatrix(i));
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        skybox.draw(irradianceShader);
-    }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteTextures(1, &hdrTexture);
+    hdrTexture = 0;
 }
 
-void IrradianceMap::convolutePrefilterMap() {
-    glGenTextures(1, &prefilterMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, nullptr);
+void IrradianceMap::prefilterLevelStep(unsigned int level) {
+    if (level == 0) {
+        glGenTextures(1, &prefilterMap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, PREFILTER_MIP_LEVELS, GL_RGBA16F, PREFILTER_SIZE, PREFILTER_SIZE);
+        setCubemapParameters(prefilterMap, GL_LINEAR_MIPMAP_LINEAR);
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
     prefilterShader.use();
     prefilterShader.setInt("environmentMap", 0);
-    prefilterShader.setMat4("projection", skybox.getProjectionMatrix());
+    prefilterShader.setFloat("environmentSize", (float)ENVIRONMENT_SIZE);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    unsigned int maxMipLevels = 5;
-    for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
-    {
-        // reisze framebuffer according to mip-level size.
-        unsigned int mipWidth = 128 * std::pow(0.5, mip);
-        unsigned int mipHeight = 128 * std::pow(0.5, mip);
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-        glViewport(0, 0, mipWidth, mipHeight);
-
-        float roughness = (float)mip / (float)(maxMipLevels - 1);
-        prefilterShader.setFloat("roughness", roughness);
-        for (unsigned int i = 0; i < 6; ++i)
-        {
-            prefilterShader.setMat4("view", skybox.getViewMatrix(i));
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, mip);
-
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            skybox.draw(prefilterShader);
-        }
-    }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // One dispatch per roughness level, z is the face
+    unsigned int mipSize = PREFILTER_SIZE >> level;
+    float roughness = (float)level / (float)(PREFILTER_MIP_LEVELS - 1);
+    prefilterShader.setFloat("roughness", roughness);
+    prefilterShader.setInt("sampleCount", PREFILTER_SAMPLE_COUNTS[level]);
+    glBindImageTexture(0, prefilterMap, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glDispatchCompute((mipSize + 7) / 8, (mipSize + 7) / 8, 6);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
 }
 
 void IrradianceMap::computeBrdfLUT() {
     glGenTextures(1, &brdfLUT);
 
-    // pre-allocate enough memory for the LUT texture.
     glBindTexture(GL_TEXTURE_2D, brdfLUT);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+    // The cached LUT allocates its own storage
+    const unsigned int parameters[] = { IBL_CACHE_VERSION, BRDF_LUT_SIZE, IBL_SAMPLE_COUNT };
+    unsigned long long key = hashBytes(HASH_SEED, parameters, sizeof(parameters));
+    std::string cacheFile = cache_path + "brdf_lut.ktx";
+    if (loadKtx(cacheFile, GL_TEXTURE_2D, brdfLUT, key))
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, brdfLUT);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+
     glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
     glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUT, 0);
 
-    glViewport(0, 0, 512, 512);
+    glViewport(0, 0, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
     brdfShader.use();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     quad.draw(brdfShader);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    saveKtx(cacheFile, GL_TEXTURE_2D, brdfLUT, GL_RG, 1, key);
+}
+
+unsigned long long IrradianceMap::environmentKey(const unsigned char* data, size_t size) {
+    const unsigned int parameters[] = { IBL_CACHE_VERSION, ENVIRONMENT_SIZE, PREFILTER_SIZE, PREFILTER_MIP_LEVELS };
+    unsigned long long key = hashBytes(HASH_SEED, parameters, sizeof(parameters));
+    key = hashBytes(key, PREFILTER_SAMPLE_COUNTS, sizeof(PREFILTER_SAMPLE_COUNTS));
+    return hashBytes(key, data, size);
 }
 
-void IrradianceMap::precompute() {
-    this->convoluteIrradianceMap();
-    this->convolutePrefilterMap();
-    this->computeBrdfLUT();
+bool IrradianceMap::saveCachedMaps() {
+    environmentRead = environmentRead || environmentReadback.poll(environmentImages);
+    prefilterRead = prefilterRead || prefilterReadback.poll(prefilterImages);
+    if (!environmentRead || !prefilterRead)
+        return false;
+
+    struct CacheFiles {
+        std::string prefix;
+        unsigned long long key;
+        SHIrradiance irradianceSH;
+        KtxImages environment, prefilter;
+    };
+    char prefix[32];
+    std::snprintf(prefix, sizeof(prefix), "%016llx", decoded->key);
+    std::shared_ptr<CacheFiles> files = std::make_shared<CacheFiles>();
+    files->prefix = cache_path + prefix;
+    files->key = decoded->key;
+    files->irradianceSH = irradianceSH;
+    files->environment = std::move(environmentImages);
+    files->prefilter = std::move(prefilterImages);
+    JobSystem::instance().schedule("save environment cache", [files]() {
+        writeKtx(files->prefix + "_environment.ktx", files->environment, files->key);
+        std::ofstream shFile(files->prefix + "_irradiance.sh", std::ios::binary);
+        shFile.write((const char*)&files->key, sizeof(files->key));
+        shFile.write((const char*)files->irradianceSH.coefficients, sizeof(files->irradianceSH.coefficients));
+        writeKtx(files->prefix + "_prefilter.ktx", files->prefilter, files->key);
+    }, nullptr, JOB_PRIORITY_BACKGROUND);
+    return true;
 }
 
 // hardcoded placement of maps
 void IrradianceMap::bind(Shader& shader) {
-    glActiveTexture(GL_TEXTURE10);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-    shader.setInt("irradianceMap", 10);
+    this->setIrradianceSH(shader);
 
     glActiveTexture(GL_TEXTURE11);
     glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
@@ -219,3 +366,12 @@ void IrradianceMap::bind(Shader& shader) {
     glBindTexture(GL_TEXTURE_2D, brdfLUT);
     shader.setInt("brdfLUT", 12);
 }
+
+void IrradianceMap::setIrradianceSH(Shader& shader) {
+    const char* names[SH_COEFFICIENT_COUNT] = {
+        "shIrradiance[0]", "shIrradiance[1]", "shIrradiance[2]", "shIrradiance[3]", "shIrradiance[4]",
+        "shIrradiance[5]", "shIrradiance[6]", "shIrradiance[7]", "shIrradiance[8]"
+    };
+    for (unsigned int i = 0; i < SH_COEFFICIENT_COUNT; i++)
+        shader.setVec3(names[i], irradianceSH.coefficients[i]);
+}
@@ -4,57 +4,155 @@
 #include <glad/gl.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <stb_image.h>
 
 #include "shader.h"
 #include "mesh.h"
+#include "ktxfile.h"
+#include "gputimer.h"
+#include "hdrfile.h"
+#include "jobsystem.h"
+#include "sphericalharmonics.h"
 
+#include <deque>
+#include <memory>
 #include <string>
 #include <iostream>
 
+// Importance samples per texel of the BRDF LUT
+const unsigned int IBL_SAMPLE_COUNT = 1024;
+// Face sizes of the maps
+const unsigned int ENVIRONMENT_SIZE = 512;
+const unsigned int PREFILTER_SIZE = 128;
+// Roughness levels of the prefiltered map
+const unsigned int PREFILTER_MIP_LEVELS = 5;
+// Importance samples per texel of each roughness level. The samples read prefiltered environment mips, so few
+// are needed, level 0 (roughness 0) is a copy of the environment
+const unsigned int PREFILTER_SAMPLE_COUNTS[PREFILTER_MIP_LEVELS] = { 1, 64, 128, 256, 256 };
+const unsigned int BRDF_LUT_SIZE = 512;
+// Part of the cache keys, bump it when the precompute shaders change
+const unsigned int IBL_CACHE_VERSION = 5;
+// GPU time per frame spent on loading an environment in the background
+const float ENVIRONMENT_LOAD_BUDGET_MS = 1.0f;
+// Bytes of the equirectangular HDR uploaded per load step, whole rows and at least one
+const unsigned int HDR_UPLOAD_BYTES = 4 << 20;
 
 class IrradianceMap {
 private:
-    Shader equirectangularToCubemapShader = Shader("cubemap.vert", "cubemap.frag");
-    Shader irradianceShader = Shader("cubemap.vert", "irradiance_convolution.frag");
-    Shader prefilterShader = Shader("cubemap.vert", "prefilter_convolution.frag");
-    Shader brdfShader = Shader("precompute_brdf.vert", "precompute_brdf.frag");
+    // Precomputed maps as KTX files, keyed by the HDR file's contents and the parameters above
+    const std::string cache_path = "../ibl_cache/";
+
+    // Compute shaders writing all faces of a level with one dispatch
+    Shader equirectangularToCubemapShader = Shader("equirect_to_cubemap.comp");
+    Shader prefilterShader = Shader("prefilter_convolution.comp");
+    Shader brdfShader = Shader("precompute_brdf.vert", "precompute_brdf.frag", ShaderDefines{ "SAMPLE_COUNT " + std::to_string(IBL_SAMPLE_COUNT) + "u" });
 
-    // static skybox
-    Skybox skybox;
     ScreenQuad quad;
 
     // framebuffer
     unsigned int captureFBO, captureRBO;
     // Image based lighting maps
-    unsigned int envCubemap;
-    unsigned int irradianceMap;
-    unsigned int prefilterMap;
-    unsigned int brdfLUT;
+    unsigned int envCubemap = 0;
+    // Diffuse irradiance, projected on the CPU while the HDR is decoded
+    SHIrradiance irradianceSH;
+    unsigned int prefilterMap = 0;
+    unsigned int brdfLUT = 0;
+
+    // CPU side of a load, written by the decode job and read once it is finished
+    struct DecodedEnvironment {
+        unsigned long long key = 0;
+        bool failed = false;
+        // The cached maps were read, they only have to be uploaded
+        bool cached = false;
+        SHIrradiance irradianceSH;
+        // Equirectangular RGB9E5, first row at the bottom
+        std::vector<unsigned int> pixels;
+        unsigned int width = 0, height = 0;
+        KtxImages environment, prefilter;
+    };
+
+    // Load steps in order, the cached path skips from UPLOAD_CACHED to BRDF_LUT
+    enum class LoadStage {
+        DECODING,
+        UPLOAD_CACHED,
+        UPLOAD_HDR,
+        CONVERT,
+        PREFILTER,
+        BRDF_LUT,
+        READBACK,
+        COMPLETE,
+        FAILED
+    };
+
+    std::string path;
+    LoadStage loadStage = LoadStage::COMPLETE;
+    std::shared_ptr<DecodedEnvironment> decoded;
+    JobHandle decodeJob;
+    // Equirectangular source of the conversion, uploaded in bands of rows
+    unsigned int hdrTexture = 0;
+    unsigned int uploadedRows = 0;
+    unsigned int prefilterLevel = 0;
+    // Cache files are written by a job once the copies arrive
+    KtxReadback environmentReadback, prefilterReadback;
+    bool environmentRead = false, prefilterRead = false;
+    KtxImages environmentImages, prefilterImages;
+
+    // Cost of the steps in units (texels times samples), with a running GPU time per unit like the point shadows
+    float msPerUnit = 1e-6f;
+    GpuTimer loadTimer;
+    std::deque<double> timedUnits;
 
     void setupFrameBuffer();
+    // Immutable RGBA16F storage with all mips, image stores have no RGB16F format
     void generateCubemapTexture();
+
+    // Hash of the HDR file's contents and the parameters
+    static unsigned long long environmentKey(const unsigned char* data, size_t size);
+    // Runs on a worker, reads the cached maps or decodes the HDR and projects the irradiance
+    static void decode(DecodedEnvironment& environment, const std::string& filepath, const std::string& cachePath);
+
+    // One step of the current stage, returns its cost in units
+    double loadStep();
+    void uploadCachedMaps();
+    // Returns the uploaded pixels
+    unsigned int uploadHDRRows();
+    void convertToCubemap();
+    void prefilterLevelStep(unsigned int level);
+    // Copies the maps back without stalling and writes the cache files on a worker
+    bool saveCachedMaps();
 public:
+    // Nothing loaded, see startLoading
     IrradianceMap();
+    // Loads the environment and all maps before returning
     IrradianceMap(std::string filepath);
     ~IrradianceMap();
 
-    void loadHDRToCubemap(std::string filepath);
+    // Decodes the HDR (or reads the cached maps) on a worker, the GL work is done by continueLoading
+    void startLoading(const std::string& filepath);
+    // Runs load steps until their estimated GPU time reaches budgetMs (at least one), true once all maps are complete.
+    // Call once per frame on the GL thread
+    bool continueLoading(float budgetMs);
+    // Blocks until all maps are complete
+    void finishLoading();
+    bool isLoaded() const {
+        return loadStage == LoadStage::COMPLETE;
+    }
+    // The file is missing or not an HDR, the maps stay empty
+    bool hasFailed() const {
+        return loadStage == LoadStage::FAILED;
+    }
+    const std::string& getPath() const {
+        return path;
+    }
 
-    // Diffuse convolution of cubemap
-    void convoluteIrradianceMap();
-    void convolutePrefilterMap();
+    // Independent of the environment, loaded from the cache file shared by all environments when possible
     void computeBrdfLUT();
 
-    
-public:
-   
-    // Assumes hdr has been loaded as cubemap texture
-    void precompute();
     void bind(Shader& shader);
-    
-    unsigned int& getIrradianceMap() {
-        return irradianceMap;
+    // shIrradiance uniform of sh_irradiance.glsl
+    void setIrradianceSH(Shader& shader);
+
+    const SHIrradiance& getIrradianceSH() const {
+        return irradianceSH;
     }
     unsigned int& getPrefilterMap() {
         return prefilterMap;
@@ -0,0 +1,332 @@
+#include "irradiancevolume.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+    const float PI = 3.14159265358979f;
+    // Start of secondary rays off a surface, against hitting it again
+    const float RAY_OFFSET = 1e-3f;
+
+    struct TracedInstance {
+        const BVH* bvh;
+        // Rays are traced in object space, with the direction unnormalized so distances stay the same
+        glm::mat4 worldToObject;
+        glm::mat3 normalMatrix;
+        glm::vec3 boundsMin, boundsMax;
+    };
+
+    // All instances of the bake, only tested against a BVH when the ray hits their world bounds
+    class BakeScene {
+    private:
+        std::vector<TracedInstance> instances;
+    public:
+        void add(const BVH* bvh, const glm::mat4& model) {
+            TracedInstance instance;
+            instance.bvh = bvh;
+            instance.worldToObject = glm::inverse(model);
+            instance.normalMatrix = glm::transpose(glm::mat3(instance.worldToObject));
+            instance.boundsMin = glm::vec3(FLT_MAX);
+            instance.boundsMax = glm::vec3(-FLT_MAX);
+            glm::vec3 corners[2] = { bvh->getBoundsMin(), bvh->getBoundsMax() };
+            for (unsigned int i = 0; i < 8; i++) {
+                glm::vec3 corner(corners[i & 1].x, corners[(i >> 1) & 1].y, corners[(i >> 2) & 1].z);
+                glm::vec3 world = glm::vec3(model * glm::vec4(corner, 1.0f));
+                instance.boundsMin = glm::min(instance.boundsMin, world);
+                instance.boundsMax = glm::max(instance.boundsMax, world);
+            }
+            instances.push_back(instance);
+        }
+
+        bool empty() const {
+            return instances.empty();
+        }
+        glm::vec3 getBoundsMin() const {
+            glm::vec3 boundsMin(FLT_MAX);
+            for (const TracedInstance& instance : instances)
+                boundsMin = glm::min(boundsMin, instance.boundsMin);
+            return boundsMin;
+        }
+        glm::vec3 getBoundsMax() const {
+            glm::vec3 boundsMax(-FLT_MAX);
+            for (const TracedInstance& instance : instances)
+                boundsMax = glm::max(boundsMax, instance.boundsMax);
+            return boundsMax;
+        }
+
+        // Closest hit, normal is the world space geometric normal of its front face
+        bool intersect(const glm::vec3& origin, const glm::vec3& direction, float& tMax, glm::vec3& normal) const {
+            glm::vec3 inverseDirection = 1.0f / direction;
+            bool hit = false;
+            for (const TracedInstance& instance : instances) {
+                float tEntry;
+                if (!intersectRayBounds(instance.boundsMin, instance.boundsMax, origin, inverseDirection, tMax, tEntry))
+                    continue;
+                glm::vec3 objectOrigin = glm::vec3(instance.worldToObject * glm::vec4(origin, 1.0f));
+                glm::vec3 objectDirection = glm::mat3(instance.worldToObject) * direction;
+                unsigned int triangle;
+                if (instance.bvh->intersect(objectOrigin, objectDirection, tMax, triangle)) {
+                    hit = true;
+                    normal = glm::normalize(instance.normalMatrix * instance.bvh->getNormal(triangle));
+                }
+            }
+            return hit;
+        }
+
+        bool occluded(const glm::vec3& origin, const glm::vec3& direction, float tMax) const {
+            glm::vec3 inverseDirection = 1.0f / direction;
+            for (const TracedInstance& instance : instances) {
+                float tEntry;
+                if (!intersectRayBounds(instance.boundsMin, instance.boundsMax, origin, inverseDirection, tMax, tEntry))
+                    continue;
+                glm::vec3 objectOrigin = glm::vec3(instance.worldToObject * glm::vec4(origin, 1.0f));
+                glm::vec3 objectDirection = glm::mat3(instance.worldToObject) * direction;
+                if (instance.bvh->occluded(objectOrigin, objectDirection, tMax))
+                    return true;
+            }
+            return false;
+        }
+    };
+
+    // Light of the directional and point lights reaching a surface, attenuated like pbr.frag
+    glm::vec3 directIrradiance(const BakeScene& scene, const glm::vec3& lightDirection, const glm::vec3& lightColor,
+        const std::vector<PointLight>& pointLights, const glm::vec3& position, const glm::vec3& normal)
+    {
+        glm::vec3 irradiance(0.0f);
+        glm::vec3 L = glm::normalize(-lightDirection);
+        float NdotL = glm::dot(normal, L);
+        if (NdotL > 0.0f && !scene.occluded(position, L, FLT_MAX))
+            irradiance += lightColor * NdotL;
+
+        for (const PointLight& light : pointLights) {
+            glm::vec3 toLight = light.position - position;
+            float distance = glm::length(toLight);
+            if (distance >= light.radius || distance <= 0.0f)
+                continue;
+            L = toLight / distance;
+            NdotL = glm::dot(normal, L);
+            if (NdotL <= 0.0f)
+                continue;
+            float window = glm::clamp(1.0f - std::pow(distance / light.radius, 4.0f), 0.0f, 1.0f);
+            float attenuation = window * window / (distance * distance);
+            if (!scene.occluded(position, L, distance))
+                irradiance += light.diffuse * attenuation * NdotL;
+        }
+        return irradiance;
+    }
+}
+
+IrradianceVolume::~IrradianceVolume() {
+    if (baking)
+        JobSystem::instance().wait(bakeJob);
+    if (texture != 0)
+        glDeleteTextures(1, &texture);
+}
+
+void IrradianceVolume::startBaking(const std::vector<IrradianceVolumeInstance>& instances, const LightingManager& lights, const SHIrradiance& environment) {
+    std::shared_ptr<BakeData> data = std::make_shared<BakeData>();
+    data->instances = instances;
+    data->lightDirection = lights.getDirectionalLight().direction;
+    data->lightColor = lights.getDirectionalLight().diffuse;
+    data->pointLights = lights.getPointLights();
+    data->environment = environment;
+
+    // Only the newest request is kept
+    if (baking)
+        pendingBake = data;
+    else
+        this->startJob(data);
+}
+
+void IrradianceVolume::startJob(const std::shared_ptr<BakeData>& data) {
+    data->bvhs = bvhs;
+    baking = data;
+    // Background, so are the BVH builds and probe ranges it splits off. The frame's parallelFors never run them
+    bakeJob = JobSystem::instance().schedule("bakeIrradianceVolume", [data]() {
+        IrradianceVolume::bake(*data);
+    }, nullptr, JOB_PRIORITY_BACKGROUND);
+}
+
+void IrradianceVolume::bake(BakeData& data) {
+    // BVHs of meshes not traced before, one job per mesh
+    std::vector<const Mesh*> missing;
+    for (const IrradianceVolumeInstance& instance : data.instances) {
+        if (data.bvhs.find(instance.mesh) == data.bvhs.end() && std::find(missing.begin(), missing.end(), instance.mesh) == missing.end())
+            missing.push_back(instance.mesh);
+    }
+    std::vector<std::shared_ptr<const BVH> > built(missing.size());
+    JobSystem::instance().parallelFor((unsigned int)missing.size(), 1, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            std::vector<glm::vec3> positions;
+            std::vector<unsigned int> indices;
+            missing[i]->getTriangles(positions, indices);
+            built[i] = std::make_shared<const BVH>(std::move(positions), indices);
+        }
+    }, "buildMeshBVHs");
+    for (size_t i = 0; i < missing.size(); i++)
+        data.bvhs[missing[i]] = built[i];
+
+    BakeScene scene;
+    for (const IrradianceVolumeInstance& instance : data.instances) {
+        const BVH& bvh = *data.bvhs[instance.mesh];
+        if (!bvh.isEmpty())
+            scene.add(&bvh, instance.model);
+    }
+    if (scene.empty())
+        return;
+
+    // Probes at the corners of the geometry's bounds, at least one spacing apart
+    glm::vec3 boundsMin = scene.getBoundsMin();
+    glm::vec3 boundsMax = glm::max(scene.getBoundsMax(), boundsMin + IRRADIANCE_VOLUME_SPACING);
+    glm::vec3 extent = boundsMax - boundsMin;
+    glm::uvec3 resolution;
+    for (int axis = 0; axis < 3; axis++) {
+        unsigned int probes = (unsigned int)std::ceil(extent[axis] / IRRADIANCE_VOLUME_SPACING) + 1;
+        resolution[axis] = std::min(std::max(probes, 2u), IRRADIANCE_VOLUME_MAX_PROBES);
+    }
+    glm::vec3 spacing = extent / glm::vec3(resolution - glm::uvec3(1));
+
+    // Fibonacci sphere, the same directions for every probe
+    std::vector<glm::vec3> directions(IRRADIANCE_VOLUME_RAYS);
+    std::vector<float> basis(IRRADIANCE_VOLUME_RAYS * SH_COEFFICIENT_COUNT);
+    const float goldenAngle = PI * (3.0f - std::sqrt(5.0f));
+    for (unsigned int r = 0; r < IRRADIANCE_VOLUME_RAYS; r++) {
+        float y = 1.0f - (r + 0.5f) * 2.0f / IRRADIANCE_VOLUME_RAYS;
+        float radius = std::sqrt(std::max(1.0f - y * y, 0.0f));
+        float phi = goldenAngle * r;
+        directions[r] = glm::vec3(std::cos(phi) * radius, y, std::sin(phi) * radius);
+        evaluateSHBasis(directions[r], &basis[r * SH_COEFFICIENT_COUNT]);
+    }
+
+    unsigned int probeCount = resolution.x * resolution.y * resolution.z;
+    std::vector<SHIrradiance> probes(probeCount);
+    std::vector<unsigned char> inside(probeCount);
+    JobSystem::instance().parallelFor(probeCount, 4, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            glm::uvec3 cell(i % resolution.x, (i / resolution.x) % resolution.y, i / (resolution.x * resolution.y));
+            glm::vec3 position = boundsMin + glm::vec3(cell) * spacing;
+
+            glm::vec3 radianceSH[SH_COEFFICIENT_COUNT];
+            for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+                radianceSH[k] = glm::vec3(0.0f);
+            unsigned int backfaces = 0;
+            for (unsigned int r = 0; r < IRRADIANCE_VOLUME_RAYS; r++) {
+                const glm::vec3& direction = directions[r];
+                float t = FLT_MAX;
+                glm::vec3 normal;
+                glm::vec3 radiance(0.0f);
+                if (!scene.intersect(position, direction, t, normal)) {
+                    radiance = evaluateRadianceSH(data.environment, direction);
+                }
+                else if (glm::dot(normal, direction) > 0.0f) {
+                    backfaces++;
+                }
+                else {
+                    // Lambertian, lit by the lights and the unoccluded environment
+                    glm::vec3 hit = position + direction * t + normal * RAY_OFFSET;
+                    glm::vec3 irradiance = directIrradiance(scene, data.lightDirection, data.lightColor, data.pointLights, hit, normal);
+                    radiance = IRRADIANCE_VOLUME_ALBEDO * (irradiance / PI + evaluateIrradianceSH(data.environment, normal));
+                }
+                for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+                    radianceSH[k] += radiance * basis[r * SH_COEFFICIENT_COUNT + k];
+            }
+
+            // Every ray stands for the same solid angle
+            for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+                radianceSH[k] *= 4.0f * PI / IRRADIANCE_VOLUME_RAYS;
+            probes[i] = irradianceFromRadianceSH(radianceSH);
+            inside[i] = backfaces > IRRADIANCE_VOLUME_BACKFACE_LIMIT * IRRADIANCE_VOLUME_RAYS;
+        }
+    }, "bakeIrradianceProbes");
+
+    // Probes inside geometry would darken the surfaces around them, use the average of their neighbours outside
+    std::vector<SHIrradiance> filled = probes;
+    const glm::ivec3 offsets[6] = { glm::ivec3(-1, 0, 0), glm::ivec3(1, 0, 0), glm::ivec3(0, -1, 0), glm::ivec3(0, 1, 0), glm::ivec3(0, 0, -1), glm::ivec3(0, 0, 1) };
+    for (unsigned int i = 0; i < probeCount; i++) {
+        if (!inside[i])
+            continue;
+        glm::ivec3 cell(i % resolution.x, (i / resolution.x) % resolution.y, i / (resolution.x * resolution.y));
+        SHIrradiance sum;
+        for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+            sum.coefficients[k] = glm::vec3(0.0f);
+        unsigned int count = 0;
+        for (const glm::ivec3& offset : offsets) {
+            glm::ivec3 neighbour = cell + offset;
+            if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, glm::ivec3(resolution))))
+                continue;
+            unsigned int n = neighbour.x + resolution.x * (neighbour.y + resolution.y * neighbour.z);
+            if (inside[n])
+                continue;
+            for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+                sum.coefficients[k] += probes[n].coefficients[k];
+            count++;
+        }
+        if (count > 0) {
+            for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+                filled[i].coefficients[k] = sum.coefficients[k] / (float)count;
+        }
+    }
+
+    // Texel (k * resolution.x + x, y, z) holds coefficient k of probe (x, y, z)
+    unsigned int width = resolution.x * SH_COEFFICIENT_COUNT;
+    data.texels.resize((size_t)width * resolution.y * resolution.z * 3);
+    for (unsigned int i = 0; i < probeCount; i++) {
+        unsigned int x = i % resolution.x, row = i / resolution.x;
+        for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++) {
+            float* texel = &data.texels[((size_t)row * width + k * resolution.x + x) * 3];
+            texel[0] = filled[i].coefficients[k].x;
+            texel[1] = filled[i].coefficients[k].y;
+            texel[2] = filled[i].coefficients[k].z;
+        }
+    }
+    data.resolution = resolution;
+    data.boundsMin = boundsMin;
+    data.boundsMax = boundsMax;
+}
+
+void IrradianceVolume::update() {
+    if (!baking || !JobSystem::instance().isFinished(bakeJob))
+        return;
+
+    std::shared_ptr<BakeData> data = baking;
+    baking.reset();
+    bakeJob.reset();
+    bvhs = data->bvhs;
+
+    if (data->resolution.x > 0) {
+        if (texture == 0 || resolution != data->resolution) {
+            if (texture != 0)
+                glDeleteTextures(1, &texture);
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_3D, texture);
+            glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGB16F, data->resolution.x * SH_COEFFICIENT_COUNT, data->resolution.y, data->resolution.z);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        }
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, data->resolution.x * SH_COEFFICIENT_COUNT, data->resolution.y, data->resolution.z,
+            GL_RGB, GL_FLOAT, data->texels.data());
+        glBindTexture(GL_TEXTURE_3D, 0);
+        resolution = data->resolution;
+        boundsMin = data->boundsMin;
+        boundsMax = data->boundsMax;
+    }
+
+    if (pendingBake) {
+        this->startJob(pendingBake);
+        pendingBake.reset();
+    }
+}
+
+void IrradianceVolume::bind(Shader& shader) {
+    glActiveTexture(GL_TEXTURE14);
+    glBindTexture(GL_TEXTURE_3D, texture);
+    shader.setInt("irradianceVolume", 14);
+    shader.setVec3("irradianceVolumeMin", boundsMin);
+    shader.setVec3("irradianceVolumeMax", boundsMax);
+    shader.setVec3("irradianceVolumeSize", glm::vec3(resolution));
+}
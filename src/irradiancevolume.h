@@ -0,0 +1,92 @@
+#ifndef IRRADIANCE_VOLUME_H
+#define IRRADIANCE_VOLUME_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "mesh.h"
+#include "light.h"
+#include "bvh.h"
+#include "jobsystem.h"
+#include "sphericalharmonics.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+// Distance between neighbouring probes, larger along axes that would need more than IRRADIANCE_VOLUME_MAX_PROBES
+const float IRRADIANCE_VOLUME_SPACING = 0.5f;
+const unsigned int IRRADIANCE_VOLUME_MAX_PROBES = 32;
+// Rays traced per probe
+const unsigned int IRRADIANCE_VOLUME_RAYS = 256;
+// Diffuse albedo of every surface, the textures only exist on the GPU
+const float IRRADIANCE_VOLUME_ALBEDO = 0.8f;
+// Probes with more of their rays hitting back faces are inside geometry, they take their neighbours' irradiance
+const float IRRADIANCE_VOLUME_BACKFACE_LIMIT = 0.25f;
+
+// A mesh as drawn in the scene
+struct IrradianceVolumeInstance {
+    const Mesh* mesh;
+    glm::mat4 model;
+};
+
+// Grid of SH irradiance probes over the bounds of the scene's geometry, baked on the CPU by tracing rays against
+// a BVH per mesh. Rays that hit a surface bring the light from LightingManager (with shadow rays) and the environment
+// bounced off it, rays that miss the environment. The probes are stored like the environment's SH irradiance, so
+// the volume replaces it inside its bounds and adds static occlusion and bounce light for a texture fetch.
+// The lights' direct light stays with the shaders
+class IrradianceVolume {
+private:
+    struct BakeData {
+        std::vector<IrradianceVolumeInstance> instances;
+        // Copies, the lights may change while baking
+        glm::vec3 lightDirection, lightColor;
+        std::vector<PointLight> pointLights;
+        SHIrradiance environment;
+        // BVHs of earlier bakes, the new ones are added
+        std::map<const Mesh*, std::shared_ptr<const BVH> > bvhs;
+
+        glm::uvec3 resolution = glm::uvec3(0);
+        // First and last probe
+        glm::vec3 boundsMin, boundsMax;
+        // RGB per coefficient and probe, coefficient k of all probes is the k-th block along x
+        std::vector<float> texels;
+    };
+
+    // Mesh BVHs are built once and kept for later bakes
+    std::map<const Mesh*, std::shared_ptr<const BVH> > bvhs;
+    std::shared_ptr<BakeData> baking, pendingBake;
+    JobHandle bakeJob;
+
+    // Coefficients of a probe are 9 texels along x, see irradiance_volume.glsl
+    unsigned int texture = 0;
+    glm::uvec3 resolution = glm::uvec3(0);
+    glm::vec3 boundsMin = glm::vec3(0.0f), boundsMax = glm::vec3(0.0f);
+
+    static void bake(BakeData& data);
+    void startJob(const std::shared_ptr<BakeData>& data);
+public:
+    IrradianceVolume() = default;
+    IrradianceVolume(const IrradianceVolume&) = delete;
+    IrradianceVolume& operator=(const IrradianceVolume&) = delete;
+    // Waits for a running bake, it reads the meshes
+    ~IrradianceVolume();
+
+    // Bakes on the job system, a bake requested while another one runs starts after it
+    void startBaking(const std::vector<IrradianceVolumeInstance>& instances, const LightingManager& lights, const SHIrradiance& environment);
+    // Uploads a finished bake, call once per frame on the GL thread
+    void update();
+    bool isBaking() const {
+        return baking != nullptr;
+    }
+    bool isBaked() const {
+        return texture != 0;
+    }
+
+    // irradianceVolume (unit 14) and its bounds, a size of 0 until the first bake is uploaded
+    void bind(Shader& shader);
+};
+
+
+#endif
@@ -0,0 +1,258 @@
+#include "jobsystem.h"
+
+#include <algorithm>
+
+namespace {
+    // Index of the queue owned by the current thread, 0 for non-worker threads
+    thread_local unsigned int tlsThreadIndex = 0;
+    // Priority of the job the current thread executes
+    thread_local JobPriority tlsPriority = JOB_PRIORITY_NORMAL;
+
+    // Job is ancestor or one of its (indirect) children
+    bool isPartOf(const Job& job, const Job* ancestor) {
+        for (const Job* current = &job; current; current = current->parent.get()) {
+            if (current == ancestor)
+                return true;
+        }
+        return false;
+    }
+}
+
+JobSystem::JobSystem(unsigned int numWorkers) : running(true), pendingJobs(0), startTime(std::chrono::steady_clock::now()) {
+    // One queue for the non-worker threads and one for every worker
+    for (unsigned int i = 0; i < numWorkers + 1; i++) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    for (unsigned int i = 1; i <= numWorkers; i++) {
+        workers.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        running = false;
+    }
+    wakeCondition.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+JobSystem& JobSystem::instance() {
+    static JobSystem jobSystem(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    return jobSystem;
+}
+
+JobHandle JobSystem::createJob(const char* label, JobFunction function, const JobHandle& parent, JobPriority priority) {
+    if (parent) {
+        parent->unfinished++;
+        priority = parent->priority;
+    }
+    else if (tlsPriority == JOB_PRIORITY_BACKGROUND) {
+        priority = JOB_PRIORITY_BACKGROUND;
+    }
+    return std::make_shared<Job>(std::move(function), label, priority, parent);
+}
+
+void JobSystem::addDependency(const JobHandle& job, const JobHandle& dependency) {
+    std::lock_guard<std::mutex> lock(dependency->continuationMutex);
+    // Nothing to wait for
+    if (dependency->finished)
+        return;
+
+    job->dependencies++;
+    dependency->continuations.push_back(job);
+}
+
+void JobSystem::submit(const JobHandle& job) {
+    // Removes the submission guard, last dependency to finish schedules the job otherwise
+    if (--job->dependencies == 0) {
+        this->push(job);
+    }
+}
+
+JobHandle JobSystem::schedule(const char* label, JobFunction function, const JobHandle& parent, JobPriority priority) {
+    JobHandle job = this->createJob(label, std::move(function), parent, priority);
+    this->submit(job);
+    return job;
+}
+
+JobHandle JobSystem::then(const JobHandle& job, const char* label, JobFunction function) {
+    JobHandle continuation = this->createJob(label, std::move(function), nullptr, job->priority);
+    this->addDependency(continuation, job);
+    this->submit(continuation);
+    return continuation;
+}
+
+void JobSystem::wait(const JobHandle& job) {
+    unsigned int threadIndex = tlsThreadIndex;
+    while (!this->isFinished(job)) {
+        if (!this->tryExecuteOne(threadIndex, job.get())) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool JobSystem::isFinished(const JobHandle& job) const {
+    return job->unfinished.load() == 0;
+}
+
+void JobSystem::parallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int begin, unsigned int end)>& function, const char* label) {
+    if (count == 0)
+        return;
+
+    // Not worth scheduling
+    grainSize = std::max(grainSize, 1u);
+    if (count <= grainSize || workers.empty()) {
+        function(0, count);
+        return;
+    }
+
+    // Do not create more ranges than there are threads to steal them
+    unsigned int numRanges = std::min((count + grainSize - 1) / grainSize, this->getNumThreads() * 4);
+    unsigned int rangeSize = (count + numRanges - 1) / numRanges;
+
+    JobHandle root = this->createJob(label, nullptr);
+    for (unsigned int begin = 0; begin < count; begin += rangeSize) {
+        unsigned int end = std::min(begin + rangeSize, count);
+        this->schedule(label, [&function, begin, end]() { function(begin, end); }, root);
+    }
+    this->submit(root);
+    this->wait(root);
+}
+
+void JobSystem::setProfileCallback(JobProfileCallback callback) {
+    this->profileCallback = std::move(callback);
+}
+
+unsigned int JobSystem::getNumThreads() const {
+    return queues.size();
+}
+
+unsigned int JobSystem::getThreadIndex() const {
+    return tlsThreadIndex;
+}
+
+void JobSystem::workerLoop(unsigned int threadIndex) {
+    tlsThreadIndex = threadIndex;
+
+    while (running) {
+        if (this->tryExecuteOne(threadIndex))
+            continue;
+
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wakeCondition.wait(lock, [this]() { return pendingJobs.load() > 0 || !running; });
+    }
+}
+
+void JobSystem::push(const JobHandle& job) {
+    WorkQueue& queue = *queues[tlsThreadIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs[job->priority].push_back(job);
+    }
+
+    {
+        // Lock so that a worker cannot miss the wake up between checking and waiting
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        pendingJobs++;
+    }
+    wakeCondition.notify_one();
+}
+
+JobHandle JobSystem::take(unsigned int queueIndex, JobPriority priority, bool newest, const Job* ancestor) {
+    WorkQueue& queue = *queues[queueIndex];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    std::deque<JobHandle>& jobs = queue.jobs[priority];
+    size_t count = jobs.size();
+    for (size_t i = 0; i < count; i++) {
+        size_t index = newest ? count - 1 - i : i;
+        if (ancestor && !isPartOf(*jobs[index], ancestor))
+            continue;
+
+        JobHandle job = std::move(jobs[index]);
+        jobs.erase(jobs.begin() + index);
+        pendingJobs--;
+        return job;
+    }
+    return nullptr;
+}
+
+JobHandle JobSystem::pop(unsigned int threadIndex, JobPriority priority, const Job* ancestor) {
+    return this->take(threadIndex, priority, true, ancestor);
+}
+
+JobHandle JobSystem::steal(unsigned int threadIndex, JobPriority priority, const Job* ancestor) {
+    unsigned int numQueues = queues.size();
+    for (unsigned int i = 1; i < numQueues; i++) {
+        JobHandle job = this->take((threadIndex + i) % numQueues, priority, false, ancestor);
+        if (job)
+            return job;
+    }
+    return nullptr;
+}
+
+bool JobSystem::tryExecuteOne(unsigned int threadIndex, const Job* ancestor) {
+    // All normal jobs before any background job
+    JobHandle job;
+    for (unsigned int priority = 0; priority < JOB_PRIORITY_COUNT && !job; priority++) {
+        job = this->pop(threadIndex, (JobPriority)priority, ancestor);
+        if (!job) {
+            job = this->steal(threadIndex, (JobPriority)priority, ancestor);
+        }
+    }
+    if (!job)
+        return false;
+
+    this->execute(job, threadIndex);
+    return true;
+}
+
+void JobSystem::execute(const JobHandle& job, unsigned int threadIndex) {
+    // Jobs it creates without a parent (parallelFor ranges) inherit its priority, restored for nested waits
+    JobPriority previousPriority = tlsPriority;
+    tlsPriority = job->priority;
+    if (!profileCallback) {
+        if (job->function)
+            job->function();
+        tlsPriority = previousPriority;
+        this->finish(job);
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (job->function)
+        job->function();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    tlsPriority = previousPriority;
+
+    this->finish(job);
+    profileCallback(job->label, threadIndex,
+        std::chrono::duration<double, std::milli>(start - startTime).count(),
+        std::chrono::duration<double, std::milli>(end - startTime).count());
+}
+
+void JobSystem::finish(const JobHandle& job) {
+    if (--job->unfinished > 0)
+        return;
+
+    std::vector<JobHandle> continuations;
+    {
+        std::lock_guard<std::mutex> lock(job->continuationMutex);
+        job->finished = true;
+        continuations.swap(job->continuations);
+    }
+
+    for (const JobHandle& continuation : continuations) {
+        if (--continuation->dependencies == 0) {
+            this->push(continuation);
+        }
+    }
+
+    if (job->parent) {
+        this->finish(job->parent);
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Job;
+using JobHandle = std::shared_ptr<Job>;
+using JobFunction = std::function<void()>;
+// Called on the executing thread after every job (times in ms since the job system started)
+using JobProfileCallback = std::function<void(const char* label, unsigned int threadIndex, double startMs, double endMs)>;
+
+// Workers take normal jobs first. Long running work (baking, decoding files, writing caches) must be scheduled
+// as background, a worker busy with a normal job is missing from every parallelFor of the frame until it is done
+enum JobPriority {
+    JOB_PRIORITY_NORMAL,
+    JOB_PRIORITY_BACKGROUND,
+    JOB_PRIORITY_COUNT
+};
+
+struct Job {
+    JobFunction function;
+    const char* label;
+    JobPriority priority;
+    // Parent is only finished after all of its children are finished
+    JobHandle parent;
+    // Own execution + unfinished children
+    std::atomic<int> unfinished;
+    // Unfinished dependencies + 1 until submitted
+    std::atomic<int> dependencies;
+
+    // Jobs to schedule once this job is finished
+    std::mutex continuationMutex;
+    std::vector<JobHandle> continuations;
+    bool finished = false;
+
+    Job(JobFunction function, const char* label, JobPriority priority, const JobHandle& parent) :
+        function(std::move(function)), label(label), priority(priority), parent(parent), unfinished(1), dependencies(1) {}
+};
+
+
+// Work stealing scheduler, every thread owns a deque per priority and pops its newest jobs (LIFO)
+// while idle threads steal the oldest jobs of the other threads (FIFO).
+// Thread index 0 is used by the thread that created the job system (and any other non-worker thread).
+// A thread waiting for a job only helps with that job and its children, so waits on the render thread
+// never pick up unrelated work.
+class JobSystem {
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs[JOB_PRIORITY_COUNT];
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue> > queues;
+
+    std::atomic<bool> running;
+    std::atomic<int> pendingJobs;
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+
+    JobProfileCallback profileCallback;
+    std::chrono::steady_clock::time_point startTime;
+
+public:
+    JobSystem(unsigned int numWorkers);
+    ~JobSystem();
+
+    // Shared job system with a worker for every additional hardware thread
+    static JobSystem& instance();
+
+    // Creates a job without scheduling it, children keep their parent from finishing.
+    // Children get the priority of their parent, jobs created by background jobs are background as well
+    JobHandle createJob(const char* label, JobFunction function, const JobHandle& parent = nullptr, JobPriority priority = JOB_PRIORITY_NORMAL);
+    // Job will only be scheduled after dependency is finished, call before submitting job
+    void addDependency(const JobHandle& job, const JobHandle& dependency);
+    // Schedules the job as soon as all dependencies are finished
+    void submit(const JobHandle& job);
+
+    JobHandle schedule(const char* label, JobFunction function, const JobHandle& parent = nullptr, JobPriority priority = JOB_PRIORITY_NORMAL);
+    // Continuation that is scheduled after job is finished, with the same priority
+    JobHandle then(const JobHandle& job, const char* label, JobFunction function);
+
+    // Executes the job's queued children (or the job itself) while waiting, never unrelated jobs
+    void wait(const JobHandle& job);
+    bool isFinished(const JobHandle& job) const;
+
+    // Splits [0, count) into ranges of at least grainSize and blocks until all ranges are processed.
+    // The ranges have the priority of the job calling it
+    void parallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int begin, unsigned int end)>& function, const char* label = "parallelFor");
+
+    void setProfileCallback(JobProfileCallback callback);
+    unsigned int getNumThreads() const;
+    unsigned int getThreadIndex() const;
+
+private:
+    void workerLoop(unsigned int threadIndex);
+    void push(const JobHandle& job);
+    // Newest job of the thread's own queue or the oldest one of another queue, of ancestor's tree if it is given
+    JobHandle take(unsigned int queueIndex, JobPriority priority, bool newest, const Job* ancestor);
+    JobHandle pop(unsigned int threadIndex, JobPriority priority, const Job* ancestor);
+    JobHandle steal(unsigned int threadIndex, JobPriority priority, const Job* ancestor);
+    bool tryExecuteOne(unsigned int threadIndex, const Job* ancestor = nullptr);
+    void execute(const JobHandle& job, unsigned int threadIndex);
+    void finish(const JobHandle& job);
+};
+
+
+#endif
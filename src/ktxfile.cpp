@@ -0,0 +1,249 @@
+#include "ktxfile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const unsigned int KTX_ENDIANNESS = 0x04030201;
+
+struct KtxHeader {
+    unsigned char identifier[12];
+    unsigned int endianness;
+    unsigned int glType;
+    unsigned int glTypeSize;
+    unsigned int glFormat;
+    unsigned int glInternalFormat;
+    unsigned int glBaseInternalFormat;
+    unsigned int pixelWidth;
+    unsigned int pixelHeight;
+    unsigned int pixelDepth;
+    unsigned int numberOfArrayElements;
+    unsigned int numberOfFaces;
+    unsigned int numberOfMipmapLevels;
+    unsigned int bytesOfKeyValueData;
+};
+
+// Size of one face of a level, KTX rows are 4 byte aligned like the default GL pack and unpack alignment
+static unsigned int imageSize(unsigned int width, unsigned int height, GLenum format)
+{
+    unsigned int rowSize = width * (format == GL_RG ? 2 : 3) * 2;
+    return ((rowSize + 3) & ~3u) * height;
+}
+
+// Single "CacheKey" entry, padded to 4 bytes
+static std::string keyValueData(unsigned long long key)
+{
+    char value[17];
+    std::snprintf(value, sizeof(value), "%016llx", key);
+    std::string pair = std::string("CacheKey") + '\0' + value + '\0';
+    unsigned int pairSize = (unsigned int)pair.size();
+    std::string data((const char*)&pairSize, sizeof(pairSize));
+    data += pair;
+    data.resize((data.size() + 3) & ~(size_t)3, '\0');
+    return data;
+}
+
+// Sizes of the first levels mips of every face, without the pixels
+static KtxImages imageLayout(GLenum target, unsigned int texture, GLenum format, unsigned int levels)
+{
+    GLenum faceTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    GLint width = 0, height = 0;
+    glBindTexture(target, texture);
+    glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(faceTarget, 0, GL_TEXTURE_HEIGHT, &height);
+
+    KtxImages ktx;
+    ktx.internalFormat = format == GL_RG ? GL_RG16F : GL_RGB16F;
+    ktx.format = format;
+    ktx.width = width;
+    ktx.height = height;
+    ktx.faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+    ktx.levels = levels;
+    ktx.images.resize(levels * ktx.faces);
+    for (unsigned int level = 0; level < levels; level++) {
+        unsigned int size = imageSize(std::max(ktx.width >> level, 1u), std::max(ktx.height >> level, 1u), format);
+        for (unsigned int face = 0; face < ktx.faces; face++)
+            ktx.images[level * ktx.faces + face].resize(size);
+    }
+    return ktx;
+}
+
+bool saveKtx(const std::string& path, GLenum target, unsigned int texture, GLenum format, unsigned int levels, unsigned long long key)
+{
+    GLenum faceTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    KtxImages ktx = imageLayout(target, texture, format, levels);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    for (unsigned int level = 0; level < levels; level++) {
+        for (unsigned int face = 0; face < ktx.faces; face++)
+            glGetTexImage(faceTarget + face, level, format, GL_HALF_FLOAT, ktx.images[level * ktx.faces + face].data());
+    }
+    return writeKtx(path, ktx, key);
+}
+
+bool writeKtx(const std::string& path, const KtxImages& ktx, unsigned long long key)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Texture cache could not be written: " << path << std::endl;
+        return false;
+    }
+    std::string keyValues = keyValueData(key);
+    KtxHeader header;
+    std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    header.endianness = KTX_ENDIANNESS;
+    header.glType = GL_HALF_FLOAT;
+    header.glTypeSize = 2;
+    header.glFormat = ktx.format;
+    header.glInternalFormat = ktx.internalFormat;
+    header.glBaseInternalFormat = ktx.format;
+    header.pixelWidth = ktx.width;
+    header.pixelHeight = ktx.height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = ktx.faces;
+    header.numberOfMipmapLevels = ktx.levels;
+    header.bytesOfKeyValueData = (unsigned int)keyValues.size();
+    file.write((const char*)&header, sizeof(header));
+    file.write(keyValues.data(), keyValues.size());
+
+    for (unsigned int level = 0; level < ktx.levels; level++) {
+        // imageSize is per face for non-array cube maps
+        unsigned int size = (unsigned int)ktx.images[level * ktx.faces].size();
+        file.write((const char*)&size, sizeof(size));
+        for (unsigned int face = 0; face < ktx.faces; face++)
+            file.write(ktx.images[level * ktx.faces + face].data(), size);
+    }
+    return (bool)file;
+}
+
+KtxReadback::~KtxReadback()
+{
+    glDeleteBuffers(1, &buffer);
+    if (fence)
+        glDeleteSync(fence);
+}
+
+void KtxReadback::start(GLenum target, unsigned int texture, GLenum format, unsigned int levels)
+{
+    GLenum faceTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    layout = imageLayout(target, texture, format, levels);
+    size_t totalSize = 0;
+    for (const std::vector<char>& image : layout.images)
+        totalSize += image.size();
+
+    if (!buffer)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, totalSize, nullptr, GL_STREAM_READ);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    // Pointers are offsets into the pack buffer
+    size_t offset = 0;
+    for (unsigned int level = 0; level < levels; level++) {
+        for (unsigned int face = 0; face < layout.faces; face++) {
+            glGetTexImage(faceTarget + face, level, format, GL_HALF_FLOAT, (void*)offset);
+            offset += layout.images[level * layout.faces + face].size();
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (fence)
+        glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool KtxReadback::poll(KtxImages& ktx)
+{
+    if (!fence)
+        return false;
+    GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    glDeleteSync(fence);
+    fence = 0;
+
+    size_t totalSize = 0;
+    for (const std::vector<char>& image : layout.images)
+        totalSize += image.size();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+    const char* data = (const char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, totalSize, GL_MAP_READ_BIT);
+    if (data) {
+        for (std::vector<char>& image : layout.images) {
+            std::memcpy(image.data(), data, image.size());
+            data += image.size();
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ktx = std::move(layout);
+    layout = KtxImages();
+    return data != nullptr;
+}
+
+bool loadKtx(const std::string& path, GLenum target, unsigned int texture, unsigned long long key)
+{
+    KtxImages ktx;
+    if (!readKtx(path, target, key, ktx))
+        return false;
+    uploadKtx(ktx, target, texture);
+    return true;
+}
+
+bool readKtx(const std::string& path, GLenum target, unsigned long long key, KtxImages& ktx)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    unsigned int faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+    KtxHeader header;
+    if (!file.read((char*)&header, sizeof(header)) || std::memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0
+        || header.endianness != KTX_ENDIANNESS || header.glType != GL_HALF_FLOAT || header.numberOfFaces != faces
+        || (header.glFormat != GL_RG && header.glFormat != GL_RGB) || header.numberOfMipmapLevels == 0)
+        return false;
+    std::string keyValues(header.bytesOfKeyValueData, '\0');
+    if (!file.read(&keyValues[0], keyValues.size()) || keyValues != keyValueData(key))
+        return false;
+
+    // Everything is read before the texture is touched, a truncated file leaves it as it was
+    std::vector<std::vector<char>> images(header.numberOfMipmapLevels * faces);
+    for (unsigned int level = 0; level < header.numberOfMipmapLevels; level++) {
+        unsigned int size = 0;
+        unsigned int expectedSize = imageSize(std::max(header.pixelWidth >> level, 1u), std::max(header.pixelHeight >> level, 1u), header.glFormat);
+        if (!file.read((char*)&size, sizeof(size)) || size != expectedSize)
+            return false;
+        for (unsigned int face = 0; face < faces; face++) {
+            std::vector<char>& image = images[level * faces + face];
+            image.resize(size);
+            if (!file.read(image.data(), size))
+                return false;
+        }
+    }
+
+    ktx.internalFormat = header.glInternalFormat;
+    ktx.format = header.glFormat;
+    ktx.width = header.pixelWidth;
+    ktx.height = header.pixelHeight;
+    ktx.faces = faces;
+    ktx.levels = header.numberOfMipmapLevels;
+    ktx.images = std::move(images);
+    return true;
+}
+
+void uploadKtx(const KtxImages& ktx, GLenum target, unsigned int texture)
+{
+    GLenum faceTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    // Same immutable storage as the maps computed on the GPU, RGB16F can't be bound as an image or viewed as RGBA16F
+    GLenum storageFormat = ktx.internalFormat == GL_RGB16F ? GL_RGBA16F : ktx.internalFormat;
+    glBindTexture(target, texture);
+    glTexStorage2D(target, ktx.levels, storageFormat, ktx.width, ktx.height);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (unsigned int level = 0; level < ktx.levels; level++) {
+        for (unsigned int face = 0; face < ktx.faces; face++) {
+            glTexSubImage2D(faceTarget + face, level, 0, 0, std::max(ktx.width >> level, 1u), std::max(ktx.height >> level, 1u),
+                ktx.format, GL_HALF_FLOAT, ktx.images[level * ktx.faces + face].data());
+        }
+    }
+}
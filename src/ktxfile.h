@@ -0,0 +1,52 @@
+#ifndef KTX_FILE_H
+#define KTX_FILE_H
+
+#include <glad/gl.h>
+
+#include <string>
+#include <vector>
+
+// KTX 1.1 files of half float 2D or cube map textures with all their mips, for caching precomputed maps.
+// The cache key is stored in the key/value data, files of another key are not loaded
+
+// Images of a file read into memory, so a worker thread can read it and the GL thread specifies the texture later
+struct KtxImages {
+    GLenum internalFormat = 0;
+    GLenum format = 0;
+    unsigned int width = 0, height = 0;
+    unsigned int faces = 0, levels = 0;
+    // Indexed by level * faces + face
+    std::vector<std::vector<char>> images;
+};
+
+// Writes the first levels mips of every face, format is GL_RG or GL_RGB
+bool saveKtx(const std::string& path, GLenum target, unsigned int texture, GLenum format, unsigned int levels, unsigned long long key);
+// The file part of saveKtx, makes no GL calls
+bool writeKtx(const std::string& path, const KtxImages& ktx, unsigned long long key);
+// Allocates the texture's storage and fills it from the file, false if it is missing, truncated or of another key or
+// layout. The texture must not have storage yet
+bool loadKtx(const std::string& path, GLenum target, unsigned int texture, unsigned long long key);
+// The file part of loadKtx, makes no GL calls
+bool readKtx(const std::string& path, GLenum target, unsigned long long key, KtxImages& ktx);
+// Immutable storage for all of the file's levels filled with its images, RGB files get RGBA16F like the computed maps.
+// The texture must not have storage yet
+void uploadKtx(const KtxImages& ktx, GLenum target, unsigned int texture);
+
+// Copies the images saveKtx writes into a pixel pack buffer and fences them, so they are read
+// once the GPU is done instead of stalling the render loop
+class KtxReadback {
+private:
+    unsigned int buffer = 0;
+    GLsync fence = 0;
+    KtxImages layout;
+public:
+    ~KtxReadback();
+
+    // Queues the copies of the first levels mips of every face
+    void start(GLenum target, unsigned int texture, GLenum format, unsigned int levels);
+    // Doesn't wait, true once the copies are done and moved into ktx
+    bool poll(KtxImages& ktx);
+};
+
+
+#endif
@@ -1,14 +1,31 @@
 #include "light.h"
+#include "jobsystem.h"
+#include "frustum.h"
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <ostream>
+#include <string>
 
 // POINTLIGHT
 PointLight::PointLight(const glm::vec3& position, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular,
     float constant, float linear, float quadratic, float far) :
     position(position), constant(constant), ambient(ambient), linear(linear), diffuse(diffuse),
     quadratic(quadratic), specular(specular), far(far) {
+    this->computeRadius();
+}
 
+void PointLight::computeRadius() {
+    // Solve quadratic * d^2 + linear * d + constant = maxIntensity / threshold, beyond that the light is below 1/256
+    const float threshold = 1.0f / 256.0f;
+    float maxIntensity = glm::max(glm::max(diffuse.r, diffuse.g), diffuse.b);
+    float c = constant - maxIntensity / threshold;
+    float distance = quadratic > 0.0f ? (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic)
+        : (linear > 0.0f ? -c / linear : far);
+    // Shadowmap does not reach further than far anyway
+    radius = glm::min(distance, far);
 }
 
 // DIRECTIONALLIGHT
@@ -17,172 +34,460 @@ DirectionalLight::DirectionalLight(const glm::vec3& direction, const glm::vec3&
 
 }
 
-template<>
-void LightMap<DirectionalLight>::generateShadowMap() {
-    // Generate new framebuffer
-    glGenFramebuffers(1, &depthMapFBO);
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-        SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    // z > 1.0 fix
-    float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-};
 
 template<>
-void LightMap<DirectionalLight>::computeLightSpaceMatrices(DirectionalLight& light, const glm::vec3& bbox) {
-    glm::vec3 sizes = glm::max(bbox, glm::vec3(7.5f));
-    //setup matrices for shadowmap
-    float near_plane = 1.0f, far_plane = sizes.z;// 7.5f;
-    glm::mat4 lightProjection = glm::ortho(-sizes.x, sizes.x, -sizes.y, sizes.y, near_plane, far_plane);
-
-    float eps = 1e-4;
-    //glm::vec3 direction = light.direction;
-    if (light.direction.x < eps && light.direction.z < eps) {
-        light.direction = glm::normalize(light.direction);
-        light.direction.x += eps;
-    }
-
-    glm::vec3 target = bbox * 0.5f;
-    glm::vec3 position = target - light.direction * sizes.z * 0.5f;
-
-    // NOTE!!!:: glm::lookat does not work straight down or up, due to using cross product on (pos-center) x up (parallel vectors) -> 0
-    glm::mat4 lightView = glm::lookAt(position, target, glm::vec3(0.0f, 1.0f, 0.0f));
-    light.lightSpaceMatrix = lightProjection * lightView;
+void LightMap<PointLight>::computeLightSpaceMatrices(PointLight& light, glm::mat4* lightSpaceMatrices, const glm::vec3& bbox) {
+    float near = 0.1f;
+    glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, near, light.far);
+
+    lightSpaceMatrices[0] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
+    lightSpaceMatrices[1] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
+    lightSpaceMatrices[2] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(0.0, 1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
+    lightSpaceMatrices[3] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0));
+    lightSpaceMatrices[4] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0));
+    lightSpaceMatrices[5] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0));
 }
 
 
+//// LightingManager
 
-template<>
-void LightMap<PointLight>::generateShadowMap() {
-    glGenFramebuffers(1, &depthMapFBO);
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depthMap);
-    for (unsigned int i = 0; i < 6; ++i)
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT,
-            SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-template<>
-void LightMap<PointLight>::computeLightSpaceMatrices(PointLight& light, const glm::vec3& bbox) {
-    float aspect = (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT;
-    float near = 0.1f;
-    glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), aspect, near, light.far);
+LightingManager::LightingManager() {
+    // The atlas starts empty so these always fit
+    for (unsigned int i = 0; i < MAX_CASCADES; i++) {
+        shadowAtlas.allocate(CASCADE_SHADOW_SIZE, cascadeRects[i]);
+    }
 
-    light.shadowTransforms[0] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
-    light.shadowTransforms[1] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
-    light.shadowTransforms[2] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(0.0, 1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
-    light.shadowTransforms[3] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0));
-    light.shadowTransforms[4] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0));
-    light.shadowTransforms[5] = shadowProj * glm::lookAt(light.position, light.position + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0));
+    // texture() on a sampler*Shadow returns the bilinear filtered result of 4 depth comparisons
+    glGenSamplers(1, &shadowSampler);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glSamplerParameteri(shadowSampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    this->updateShaderDefines();
 }
 
-
-//// LightingManager
-
 LightingManager::~LightingManager() {
-    glDeleteBuffers(1, &uboLights);
+    glDeleteBuffers(1, &ssboPointLights);
+    glDeleteBuffers(1, &ssboPointLightShadows);
+    glDeleteSamplers(1, &shadowSampler);
 }
 
 void LightingManager::setDirectionalLight(const DirectionalLight& directionalLight) {
     this->directionalLight = directionalLight;
+    for (unsigned int i = 0; i < MAX_CASCADES; i++) {
+        this->directionalLight.shadowRects[i] = shadowAtlas.getUvRect(cascadeRects[i]);
+    }
 }
 
-void LightingManager::addPointLight(const PointLight& pointLight) {
+void LightingManager::addPointLight(const PointLight& pointLight, unsigned int shadowResolution, PointShadowType shadowType) {
     this->pointLights.push_back(pointLight);
-    this->pointLightMaps.push_back(std::make_unique<LightMap<PointLight> >());
+    this->pointLightShadows.push_back(PointLightShadow());
+    this->pointShadowStates.push_back(PointShadowState());
+
+    // Only a limited amount of lights have a shadow, -1 when the array is full
+    PointLight& light = this->pointLights.back();
+    light.shadowType = shadowType;
+    unsigned int size = shadowType == POINT_SHADOW_CUBE ? POINT_SHADOW_SIZE : PARABOLOID_SHADOW_SIZE;
+    light.shadowIndex = shadowType == POINT_SHADOW_CUBE ? pointShadowMaps.allocate() : paraboloidShadowMaps.allocate();
+    light.shadowScale = (float)glm::min(shadowResolution, size) / size;
+    this->markDirty(pointLights.size() - 1);
 }
 
-// Use ubo for lighting
+void LightingManager::removePointLights(unsigned int count) {
+    count = glm::min(count, (unsigned int)pointLights.size());
+    for (unsigned int i = 0; i < count; i++) {
+        const PointLight& light = pointLights.back();
+        if (light.shadowIndex >= 0 && light.shadowType == POINT_SHADOW_CUBE)
+            pointShadowMaps.free(light.shadowIndex);
+        else if (light.shadowIndex >= 0)
+            paraboloidShadowMaps.free(light.shadowIndex);
+        pointLights.pop_back();
+        pointLightShadows.pop_back();
+        pointShadowStates.pop_back();
+    }
+    // Data in the ssbos stays valid, only the count in the header shrinks
+    dirtyBegin = glm::min(dirtyBegin, (unsigned int)pointLights.size());
+    dirtyEnd = glm::min(dirtyEnd, (unsigned int)pointLights.size());
+}
+
+// Ssbos for the point lights, the directional light is per frame data
 void LightingManager::setupGlBuffers() {
-    glGenBuffers(1, &uboLights);
+    glGenBuffers(1, &ssboPointLights);
+    glGenBuffers(1, &ssboPointLightShadows);
+    this->reallocateGlBuffers(glm::max((unsigned int)pointLights.size(), 1u));
+}
 
-    glBindBuffer(GL_UNIFORM_BUFFER, uboLights);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(DirectionalLight) + sizeof(PointLight) * pointLights.size(), NULL, GL_STATIC_DRAW);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+void LightingManager::reallocateGlBuffers(unsigned int capacity) {
+    pointLightCapacity = capacity;
 
-    glBindBufferRange(GL_UNIFORM_BUFFER, 1, uboLights, 0, sizeof(DirectionalLight) + sizeof(PointLight) * pointLights.size());
-}
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboPointLights);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PointLight) * capacity, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboPointLightShadows);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PointLightShadow) * capacity, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ssboPointLights);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboPointLightShadows);
 
-// Bind for the scene draw call
-void LightingManager::bind(Shader& shader, glm::vec3 bbox) {
-    // Configure light space view matrices
-    this->configureMatrices(bbox);
+    // Old contents are gone
+    dirtyBegin = 0;
+    dirtyEnd = pointLights.size();
+}
 
-    glBindBuffer(GL_UNIFORM_BUFFER, uboLights);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(DirectionalLight), &directionalLight);
-    glBufferSubData(GL_UNIFORM_BUFFER, sizeof(DirectionalLight), sizeof(PointLight) * pointLights.size(), &pointLights[0]);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+void LightingManager::update(const glm::vec3& sceneMin, const glm::vec3& sceneMax, const ShadowCamera& camera, FrameRingBuffer& frameData) {
+    // Configure light space view matrices
+    this->configureMatrices(sceneMin, sceneMax, camera);
+    this->uploadGlBuffers(frameData);
+    this->updateShaderDefines();
+    this->schedulePointShadows(camera);
+}
 
+// Bind for the scene draw call
+void LightingManager::bind(Shader& shader) {
     // Currently using textures from 4 for shadowmaps
     glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, directionalLightMap.getDepthMap());
-    shader.setInt("depthMap", 4);
+    glBindTexture(GL_TEXTURE_2D, shadowAtlas.getTexture());
+    glBindSampler(4, shadowSampler);
+    shader.setInt("shadowAtlas", 4);
+
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, pointShadowMaps.getTexture());
+    glBindSampler(5, shadowSampler);
+    shader.setInt("pointShadowMaps", 5);
+
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, paraboloidShadowMaps.getTexture());
+    glBindSampler(7, shadowSampler);
+    shader.setInt("paraboloidShadowMaps", 7);
+
+    // Only the EVSM variant samples the moments, the filter taps are part of the variant.
+    // Bound whenever they exist, the EVSM variant may stand in while another one compiles
+    if (cascadeMoments) {
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeMoments->getTexture());
+        shader.setInt("cascadeMoments", 6);
+        shader.setVec2("shadowMomentExponents", glm::vec2(EVSM_POSITIVE_EXPONENT, EVSM_NEGATIVE_EXPONENT));
+    }
+}
 
-    for (unsigned int i = 0; i < pointLights.size(); i++) {
-        glActiveTexture(GL_TEXTURE5 + i);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, pointLightMaps[i]->getDepthMap());
+const ShaderDefines& LightingManager::getShaderDefines() const {
+    return shaderDefines;
+}
 
-        std::ostringstream os;
-        os << "cubeDepthMap[" << i << "]";
-        std::string depthMapName = std::move(os).str();
-        shader.setInt(depthMapName, 5 + i);
+void LightingManager::updateShaderDefines() {
+    bool pointShadows = false;
+    for (const PointLight& light : pointLights) {
+        if (light.shadowIndex >= 0) {
+            pointShadows = true;
+            break;
+        }
     }
+    unsigned int variant = shadowQuality | (pointLights.empty() ? 0x10 : 0) | (pointShadows ? 0 : 0x20);
+    // Rebuilt only when the variant changes so the renderer can compare them cheaply
+    if (variant == shaderVariant)
+        return;
+    shaderVariant = variant;
+
+    const int filterTaps[SHADOW_QUALITY_COUNT] = { 1, 4, 8, 16, 1 };
+    shaderDefines.clear();
+    shaderDefines.push_back("SHADOW_FILTER_TAPS " + std::to_string(filterTaps[shadowQuality]));
+    if (shadowQuality == SHADOW_EVSM)
+        shaderDefines.push_back("SHADOW_MOMENTS true");
+    if (pointLights.empty())
+        shaderDefines.push_back("NO_POINT_LIGHTS true");
+    if (!pointShadows)
+        shaderDefines.push_back("NO_POINT_SHADOWS true");
+}
+
+void LightingManager::configureMatrices(const glm::vec3& sceneMin, const glm::vec3& sceneMax, const ShadowCamera& camera) {
+    // Point lights, only the moved ones need new matrices. Independent per light so spread over the worker threads
+    JobSystem::instance().parallelFor(dirtyEnd - dirtyBegin, 16, [this](unsigned int begin, unsigned int end) {
+        for (unsigned int i = dirtyBegin + begin; i < dirtyBegin + end; i++) {
+            // Paraboloid projection is done in the vertex shader from the light position
+            if (pointLights[i].shadowIndex >= 0 && pointLights[i].shadowType == POINT_SHADOW_CUBE) {
+                LightMap<PointLight>::computeLightSpaceMatrices(pointLights[i], pointLightShadows[i].shadowTransforms);
+            }
+        }
+    }, "configureMatrices");
+
+    // directional light, follows the camera so recomputed every frame
+    this->configureCascades(sceneMin, sceneMax, camera);
 }
 
-void LightingManager::configureMatrices(glm::vec3 bbox) {
-    // Point lights
+void LightingManager::schedulePointShadows(const ShadowCamera& camera) {
+    // Faces that were never rendered or whose light moved go first
+    const float INVALID_FACE_PRIORITY = 1.0e6f;
+    const glm::vec3 faceDirections[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+    // Dual paraboloid hemispheres look along +z and -z
+    const glm::vec3* hemisphereDirections = faceDirections + 4;
+    frame++;
+
+    // Query results arrive a few frames late, keep a running cost per face
+    double milliseconds;
+    while (pointShadowTimer.getResult(milliseconds)) {
+        unsigned int faces = timedFaceCounts.front();
+        timedFaceCounts.pop_front();
+        shadowStats.gpuMs = (float)milliseconds;
+        if (faces > 0)
+            msPerFace = glm::mix(msPerFace, (float)milliseconds / faces, 0.25f);
+    }
+
+    glm::mat4 projection = glm::perspective(camera.fovY, camera.aspectRatio, camera.nearPlane, camera.farPlane);
+    glm::vec4 planes[6];
+    extractFrustumPlanes(projection * camera.view, planes);
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(camera.view)[3]);
+
+    struct Candidate {
+        float priority;
+        unsigned int light;
+        unsigned int face;
+    };
+    std::vector<Candidate> candidates;
+    ShadowUpdateStats stats;
+    unsigned int ageSum = 0;
     for (unsigned int i = 0; i < pointLights.size(); i++) {
-        pointLightMaps[i]->computeLightSpaceMatrices(pointLights[i]);
+        const PointLight& light = pointLights[i];
+        PointShadowState& state = pointShadowStates[i];
+        state.scheduledFaces = 0;
+        if (light.shadowIndex < 0)
+            continue;
+
+        bool paraboloid = light.shadowType == POINT_SHADOW_PARABOLOID;
+        unsigned int numFaces = paraboloid ? 2 : 6;
+        for (unsigned int face = 0; face < numFaces; face++) {
+            // Box around the part of the light's range the face looks at, faces out of view keep their old content
+            glm::vec3 direction = paraboloid ? hemisphereDirections[face] : faceDirections[face];
+            glm::vec3 center = light.position + direction * (0.5f * light.radius);
+            glm::vec3 extents = glm::vec3(light.radius) - glm::abs(direction) * (0.5f * light.radius);
+            if (!isBoxInFrustum(planes, center, extents))
+                continue;
+
+            unsigned int age = frame - state.lastUpdate[face];
+            bool valid = (state.validFaces & (1 << face)) != 0;
+            stats.visibleFaces++;
+            stats.invalidFaces += valid ? 0 : 1;
+            stats.maxAge = glm::max(stats.maxAge, age);
+            ageSum += age;
+
+            // Screen space size of the region and a falloff with the distance to the camera
+            float distance = glm::max(glm::length(center - cameraPosition), 0.01f);
+            float screenSize = glm::min(light.radius / distance, 1.0f);
+            float importance = screenSize * screenSize / (1.0f + distance / light.far);
+            float priority = importance * (age + 1) + (valid ? 0.0f : INVALID_FACE_PRIORITY);
+            candidates.push_back({ priority, i, face });
+        }
+    }
+
+    // As many faces as fit the budget, at least one so every shadow is refreshed eventually
+    unsigned int budgetFaces = (unsigned int)glm::max(pointShadowBudget / glm::max(msPerFace, 0.001f), 1.0f);
+    unsigned int count = glm::min(budgetFaces, (unsigned int)candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+        [](const Candidate& a, const Candidate& b) { return a.priority > b.priority; });
+    for (unsigned int i = 0; i < count; i++) {
+        PointShadowState& state = pointShadowStates[candidates[i].light];
+        state.scheduledFaces |= 1 << candidates[i].face;
+        state.validFaces |= 1 << candidates[i].face;
+        state.lastUpdate[candidates[i].face] = frame;
+    }
+
+    stats.scheduledFaces = count;
+    stats.averageAge = stats.visibleFaces > 0 ? (float)ageSum / stats.visibleFaces : 0.0f;
+    stats.gpuMs = shadowStats.gpuMs;
+    stats.msPerFace = msPerFace;
+    shadowStats = stats;
+}
+
+void LightingManager::configureCascades(const glm::vec3& sceneMin, const glm::vec3& sceneMax, const ShadowCamera& camera) {
+    DirectionalLight& light = directionalLight;
+
+    // Fixed light orientation, only the ortho bounds move. lookAt does not work straight down or up
+    glm::vec3 direction = glm::normalize(light.direction);
+    glm::vec3 up = glm::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+    // Casters between the light and a cascade can be outside of the camera frustum, extend towards the light up to the scene bounds
+    float sceneMaxZ = -FLT_MAX;
+    for (unsigned int corner = 0; corner < 8; corner++) {
+        glm::vec3 point((corner & 1) ? sceneMax.x : sceneMin.x, (corner & 2) ? sceneMax.y : sceneMin.y, (corner & 4) ? sceneMax.z : sceneMin.z);
+        sceneMaxZ = glm::max(sceneMaxZ, (lightRotation * glm::vec4(point, 1.0f)).z);
+    }
+
+    glm::mat4 inverseView = glm::inverse(camera.view);
+    float tanHalfFovY = std::tan(camera.fovY * 0.5f);
+    float tanHalfFovX = tanHalfFovY * camera.aspectRatio;
+    float nearPlane = camera.nearPlane;
+    float farPlane = glm::min(camera.farPlane, MAX_SHADOW_DISTANCE);
+
+    float sliceNear = nearPlane;
+    float previousSplit = 0.0f;
+    for (unsigned int i = 0; i < light.numCascades; i++) {
+        // Practical split scheme, mix of logarithmic and uniform splits
+        float p = (float)(i + 1) / light.numCascades;
+        float logSplit = nearPlane * std::pow(farPlane / nearPlane, p);
+        float uniformSplit = nearPlane + (farPlane - nearPlane) * p;
+        float sliceFar = CASCADE_SPLIT_LAMBDA * logSplit + (1.0f - CASCADE_SPLIT_LAMBDA) * uniformSplit;
+        light.cascadeSplits[i] = sliceFar;
+
+        // Bounding sphere of the slice, does not change size when the camera rotates
+        glm::vec3 corners[8];
+        glm::vec3 center(0.0f);
+        for (unsigned int c = 0; c < 8; c++) {
+            float depth = (c & 4) ? sliceFar : sliceNear;
+            glm::vec4 viewCorner((c & 1 ? 1.0f : -1.0f) * tanHalfFovX * depth, (c & 2 ? 1.0f : -1.0f) * tanHalfFovY * depth, -depth, 1.0f);
+            corners[c] = glm::vec3(inverseView * viewCorner);
+            center += corners[c] / 8.0f;
+        }
+        float radius = 0.0f;
+        for (unsigned int c = 0; c < 8; c++) {
+            radius = glm::max(radius, glm::length(corners[c] - center));
+        }
+        // Quantize so float noise does not change the projection size
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // Snap the center to whole shadow texels, stops shimmering when the camera moves
+        float texelSize = 2.0f * radius / cascadeRects[i].size;
+        glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+        lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+        lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+        // Light looks down -z
+        float maxZ = glm::max(lightCenter.z + radius, sceneMaxZ);
+        float minZ = lightCenter.z - radius;
+        glm::mat4 lightProjection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius, -maxZ, -minZ);
+        light.lightSpaceMatrices[i] = lightProjection * lightRotation;
+
+        // Next cascade starts at the blend band of this one, the shaders fade between them there
+        sliceNear = sliceFar - (sliceFar - previousSplit) * light.cascadeBlend;
+        previousSplit = sliceFar;
+    }
+}
+
+void LightingManager::uploadGlBuffers(FrameRingBuffer& frameData) {
+    if (pointLights.size() > pointLightCapacity) {
+        this->reallocateGlBuffers(glm::max((unsigned int)pointLights.size(), 2 * pointLightCapacity));
     }
 
-    // directional light
-    directionalLightMap.computeLightSpaceMatrices(directionalLight, bbox);
+    // Directional light is recomputed every frame and small
+    LightsHeader header;
+    header.directionalLight = directionalLight;
+    header.numPointLights = pointLights.size();
+    frameData.bindUniform(1, &header, sizeof(LightsHeader));
+
+    if (dirtyBegin >= dirtyEnd)
+        return;
+
+    // Only upload the changed range
+    unsigned int count = dirtyEnd - dirtyBegin;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboPointLights);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(PointLight) * dirtyBegin, sizeof(PointLight) * count, &pointLights[dirtyBegin]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboPointLightShadows);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(PointLightShadow) * dirtyBegin, sizeof(PointLightShadow) * count, &pointLightShadows[dirtyBegin]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    dirtyBegin = dirtyEnd = 0;
 }
 
-void LightingManager::bindDirectionalShadowMap() {
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, directionalLightMap.getFBO());
+void LightingManager::markDirty(unsigned int index) {
+    // Shadow has to be rendered again from the new position
+    pointShadowStates[index].validFaces = 0;
+
+    if (dirtyBegin >= dirtyEnd) {
+        dirtyBegin = index;
+        dirtyEnd = index + 1;
+        return;
+    }
+    dirtyBegin = glm::min(dirtyBegin, index);
+    dirtyEnd = glm::max(dirtyEnd, index + 1);
+}
+
+void LightingManager::bindDirectionalShadowMap(unsigned int cascade) {
+    shadowAtlas.bindForRendering(cascadeRects[cascade]);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
     glCullFace(GL_FRONT);
-    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void LightingManager::filterShadowMoments() {
+    if (shadowQuality != SHADOW_EVSM)
+        return;
+
+    for (unsigned int cascade = 0; cascade < directionalLight.numCascades; cascade++) {
+        cascadeMoments->filter(shadowAtlas, cascadeRects[cascade], cascade);
+    }
+    cascadeMoments->generateMipmaps();
 }
 
 void LightingManager::bindPointShadowMap(unsigned int index) {
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, pointLightMaps[index]->getFBO());
+    const PointLight& light = pointLights[index];
+    pointShadowMaps.bindForRendering(light.shadowIndex, (unsigned int)(light.shadowScale * POINT_SHADOW_SIZE));
+    // The geometry shader always renders all faces, so they are all up to date afterwards
+    PointShadowState& state = pointShadowStates[index];
+    for (unsigned int face = 0; face < 6; face++) {
+        state.lastUpdate[face] = frame;
+    }
+    state.validFaces = 0x3F;
+    renderedFaces += 6;
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
     glCullFace(GL_FRONT);
-    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void LightingManager::bindPointShadowMaps() {
+    for (unsigned int i = 0; i < pointLights.size(); i++) {
+        const PointLight& light = pointLights[i];
+        if (light.shadowIndex < 0 || light.shadowType != POINT_SHADOW_CUBE)
+            continue;
+
+        // Faces that are not scheduled keep their previous content
+        unsigned int resolution = (unsigned int)(light.shadowScale * POINT_SHADOW_SIZE);
+        unsigned char faces = pointShadowStates[i].scheduledFaces;
+        pointShadowMaps.clear(light.shadowIndex, resolution, faces);
+        for (unsigned int face = 0; face < 6; face++) {
+            renderedFaces += (faces >> face) & 1;
+        }
+        glViewportIndexedf(light.shadowIndex, 0.0f, 0.0f, (float)resolution, (float)resolution);
+    }
+    pointShadowMaps.bind();
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+}
+
+void LightingManager::bindParaboloidShadowMap(unsigned int index, unsigned int hemisphere) {
+    const PointLight& light = pointLights[index];
+    paraboloidShadowMaps.bindForRendering(light.shadowIndex, hemisphere, (unsigned int)(light.shadowScale * PARABOLOID_SHADOW_SIZE));
+    renderedFaces++;
+    glEnable(GL_DEPTH_TEST);
+    // Winding is not preserved by the paraboloid projection
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_CLIP_DISTANCE0);
+}
+
+void LightingManager::beginPointShadowUpdate() {
+    renderedFaces = 0;
+    timingPointShadows = pointShadowTimer.begin();
+}
+
+void LightingManager::endPointShadowUpdate() {
+    if (!timingPointShadows)
+        return;
+
+    pointShadowTimer.end();
+    timedFaceCounts.push_back(renderedFaces);
+    timingPointShadows = false;
 }
 
 void LightingManager::releaseShadowMap() {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_CLIP_DISTANCE0);
     glDisable(GL_CULL_FACE);
     glCullFace(GL_BACK);
 }
@@ -191,10 +496,63 @@ unsigned int LightingManager::getNumPointLights() {
     return pointLights.size();
 }
 
-unsigned int& LightingManager::getDepthCubemap(int index) {
-    return pointLightMaps[index]->getDepthMap();
+unsigned int LightingManager::getDepthCubemap(int index) {
+    return pointShadowMaps.getCubeView(pointLights[index].shadowIndex);
 }
 
 const PointLight& LightingManager::getPointLight(int index) {
     return pointLights[index];
 }
+
+const std::vector<PointLight>& LightingManager::getPointLights() const {
+    return pointLights;
+}
+
+const std::vector<PointLightShadow>& LightingManager::getPointLightShadows() const {
+    return pointLightShadows;
+}
+
+const DirectionalLight& LightingManager::getDirectionalLight() const {
+    return directionalLight;
+}
+
+void LightingManager::setNumCascades(unsigned int numCascades) {
+    directionalLight.numCascades = glm::clamp(numCascades, 1u, MAX_CASCADES);
+}
+
+void LightingManager::setShadowQuality(ShadowQuality quality) {
+    shadowQuality = quality;
+    if (quality == SHADOW_EVSM && !cascadeMoments)
+        cascadeMoments = std::make_unique<ShadowMoments>(CASCADE_SHADOW_SIZE, MAX_CASCADES);
+    this->updateShaderDefines();
+}
+
+void LightingManager::setPointShadowBudget(float milliseconds) {
+    pointShadowBudget = milliseconds;
+}
+
+unsigned char LightingManager::getScheduledShadowFaces(int index) const {
+    return pointShadowStates[index].scheduledFaces;
+}
+
+unsigned int LightingManager::getShadowAge(int index) const {
+    const PointShadowState& state = pointShadowStates[index];
+    unsigned int numFaces = pointLights[index].shadowType == POINT_SHADOW_PARABOLOID ? 2 : 6;
+    unsigned int oldest = state.lastUpdate[0];
+    for (unsigned int face = 1; face < numFaces; face++) {
+        oldest = glm::min(oldest, state.lastUpdate[face]);
+    }
+    return frame - oldest;
+}
+
+const ShadowUpdateStats& LightingManager::getShadowUpdateStats() const {
+    return shadowStats;
+}
+
+void LightingManager::setPointLightPosition(int index, glm::vec3 pos) {
+    if (pointLights[index].position == pos)
+        return;
+
+    pointLights[index].position = pos;
+    this->markDirty(index);
+}
@@ -5,15 +5,60 @@
 #include <glm/glm.hpp>
 
 #include "shader.h"
+#include "shadowatlas.h"
+#include "shadowmoments.h"
+#include "gputimer.h"
+#include "ringbuffer.h"
 
+#include <deque>
+#include <memory>
 #include <vector>
 #include <type_traits> 
 
 // constants
-const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+// 2D shadow maps share one atlas
+const unsigned int SHADOW_ATLAS_SIZE = 4096;
+const unsigned int MIN_SHADOW_ATLAS_RECT = 128;
+// Directional light cascades, 4 x 1024^2 is the memory of a single 2048^2 map
+const unsigned int MAX_CASCADES = 4;
+const unsigned int CASCADE_SHADOW_SIZE = 1024;
+// Cascades only cover the camera frustum up to this distance
+const float MAX_SHADOW_DISTANCE = 40.0f;
+// Weight of the logarithmic splits in the practical split scheme (rest is uniform)
+const float CASCADE_SPLIT_LAMBDA = 0.75f;
+// Face size of the point shadow cube map array, lights can use less
+const unsigned int POINT_SHADOW_SIZE = 1024;
+// Layers of the cube map array, point lights beyond this count are not shadowed
+const unsigned int MAX_POINT_LIGHT_SHADOWS = 8;
+// Hemisphere size and count of the dual paraboloid shadows
+const unsigned int PARABOLOID_SHADOW_SIZE = 1024;
+const unsigned int MAX_PARABOLOID_SHADOWS = 16;
+
+// How a point light's shadow is stored, shadowIndex refers to the matching array
+enum PointShadowType {
+    POINT_SHADOW_CUBE,          // six 90 degree faces
+    POINT_SHADOW_PARABOLOID     // two hemispheres, a third of the passes and memory but less precise
+};
+// The paraboloid projection is done per vertex and is not linear, so edges between the vertices are straight
+// where the map should curve. Only use it for lights whose casters are finely tessellated compared to their
+// distance from the light, coarse meshes (e.g. the scene's cubes) get shadows that are bent and leak
+
+// Default GPU time per frame for re-rendering point light shadow faces
+const float POINT_SHADOW_BUDGET_MS = 1.0f;
+
+// Shadow filtering tiers, every tap is a hardware depth comparison with bilinear filtering.
+// EVSM costs a single filtered fetch per pixel however wide the blur is
+enum ShadowQuality {
+    SHADOW_HARD,        // single tap (2x2 PCF)
+    SHADOW_POISSON_4,   // rotated Poisson disk
+    SHADOW_POISSON_8,
+    SHADOW_POISSON_16,
+    SHADOW_EVSM,        // prefiltered moments for the cascades, one tap for point lights
+    SHADOW_QUALITY_COUNT
+};
 
 
-// std140 layout 4 bytes/vec4
+// std430 layout in the point light SSBO, shadow matrices are stored in a separate buffer
 struct PointLight {
     glm::vec3 position;
     float constant;
@@ -23,8 +68,14 @@ struct PointLight {
     float quadratic;
     glm::vec3 specular;
     float far;
-
-    glm::mat4 shadowTransforms[6];
+    // Distance at which the attenuated light becomes negligible
+    float radius;
+    // Layer in the shadow cube map array, -1 if the light does not cast shadows
+    int shadowIndex = -1;
+    // Used part of every face, shadow resolution / size of the shadow array
+    float shadowScale = 1.0f;
+    // PointShadowType
+    int shadowType = POINT_SHADOW_CUBE;
 
     PointLight() {
 
@@ -32,6 +83,36 @@ struct PointLight {
 
     PointLight(const glm::vec3& position, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular,
         float constant, float linear, float quadratic, float far);
+
+    void computeRadius();
+};
+
+// Six view projection matrices, one per cubemap face
+struct PointLightShadow {
+    glm::mat4 shadowTransforms[6];
+};
+
+
+// Update bookkeeping of a point light's shadow, bit i stands for face (or hemisphere) i
+struct PointShadowState {
+    // Frame the face was last rendered
+    unsigned int lastUpdate[6] = { 0, 0, 0, 0, 0, 0 };
+    // Faces rendered since the light last moved
+    unsigned char validFaces = 0;
+    // Faces to render this frame
+    unsigned char scheduledFaces = 0;
+};
+
+// How the point shadow budget was spent, ages are in frames and only count faces in view
+struct ShadowUpdateStats {
+    unsigned int scheduledFaces = 0;
+    unsigned int visibleFaces = 0;
+    unsigned int invalidFaces = 0;
+    unsigned int maxAge = 0;
+    float averageAge = 0.0f;
+    // Last measured point shadow pass and the running estimate per face
+    float gpuMs = 0.0f;
+    float msPerFace = 0.0f;
 };
 
 
@@ -45,81 +126,156 @@ struct DirectionalLight {
     float pad3;
     glm::vec3 specular;
     float pad4;
-    glm::mat4 lightSpaceMatrix;
+    glm::mat4 lightSpaceMatrices[MAX_CASCADES];
+    // Offset (xy) and scale (zw) of every cascade in the atlas
+    glm::vec4 shadowRects[MAX_CASCADES];
+    // View space depth where each cascade ends (vec4 to avoid the std140 array stride)
+    glm::vec4 cascadeSplits;
+    unsigned int numCascades = MAX_CASCADES;
+    // Last part of a cascade (fraction of its depth range) blended with the next one
+    float cascadeBlend = 0.1f;
+    float pad5[2];
 
     DirectionalLight() {}
     DirectionalLight(const glm::vec3& direction, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular);
 };
 
 
+// Camera the directional light cascades are fitted to
+struct ShadowCamera {
+    glm::mat4 view;
+    float fovY;
+    float aspectRatio;
+    float nearPlane;
+    float farPlane;
+};
+
+
+// Light space matrices per light type, the shadowmaps themselves live in the atlas and cube map array
 template <class L>
 class LightMap {
-    unsigned int depthMapFBO;
-    unsigned int depthMap;
 public:
-    LightMap() {
-        //static_assert(std::is_same<L, Light>::value, "Works only with Lights!");
-        this->generateShadowMap();
-    }
-
-    ~LightMap() {
-        glDeleteFramebuffers(1, &depthMapFBO);
-        glDeleteTextures(1, &depthMap);
-    }
-
-    void generateShadowMap();
     // Not the cleanest solution for lightspacematrix computation
-    void computeLightSpaceMatrices(L& light, const glm::vec3& bbox = glm::vec3(0.0f));
-
-    unsigned int& getFBO() {
-        return depthMapFBO;
-    }
-
-    //depthmap/shadowmap
-    unsigned int& getDepthMap() {
-        return depthMap;
-    }
+    static void computeLightSpaceMatrices(L& light, glm::mat4* lightSpaceMatrices, const glm::vec3& bbox = glm::vec3(0.0f));
 };
 
 
 
 
 
+// Directional light and point light count in the lights ubo (std140)
+struct LightsHeader {
+    DirectionalLight directionalLight;
+    unsigned int numPointLights;
+    unsigned int pad[3];
+};
+
 class LightingManager {
 private:
     DirectionalLight directionalLight;
     std::vector<PointLight> pointLights;
-
-    LightMap<DirectionalLight> directionalLightMap;
-    std::vector<std::unique_ptr<LightMap<PointLight> > > pointLightMaps;
-
-    unsigned int uboLights;
+    std::vector<PointLightShadow> pointLightShadows;
+    std::vector<PointShadowState> pointShadowStates;
+
+    ShadowAtlas shadowAtlas = ShadowAtlas(SHADOW_ATLAS_SIZE, MIN_SHADOW_ATLAS_RECT);
+    ShadowCubeArray pointShadowMaps = ShadowCubeArray(POINT_SHADOW_SIZE, MAX_POINT_LIGHT_SHADOWS);
+    ShadowParaboloidArray paraboloidShadowMaps = ShadowParaboloidArray(PARABOLOID_SHADOW_SIZE, MAX_PARABOLOID_SHADOWS);
+    ShadowRect cascadeRects[MAX_CASCADES];
+    // Comparison sampler bound together with the shadowmaps, the textures keep their raw depth state for debug views
+    unsigned int shadowSampler;
+    ShadowQuality shadowQuality = SHADOW_POISSON_8;
+    // Moments of the cascades, only allocated once EVSM is selected
+    std::unique_ptr<ShadowMoments> cascadeMoments;
+
+    // Point shadow scheduling, faces are ranked and only as many as fit the budget are rendered
+    float pointShadowBudget = POINT_SHADOW_BUDGET_MS;
+    float msPerFace = 0.05f;
+    unsigned int frame = 0;
+    GpuTimer pointShadowTimer;
+    bool timingPointShadows = false;
+    // Faces rendered in every measurement that has no result yet
+    std::deque<unsigned int> timedFaceCounts;
+    unsigned int renderedFaces = 0;
+    ShadowUpdateStats shadowStats;
+
+    // Lighting shader variant of the current shadow quality and lights
+    ShaderDefines shaderDefines;
+    unsigned int shaderVariant = ~0u;
+
+    unsigned int ssboPointLights;
+    unsigned int ssboPointLightShadows;
+    // Number of point lights the ssbos can hold
+    unsigned int pointLightCapacity = 0;
+
+    // Range of point lights that changed since the last upload [begin, end)
+    unsigned int dirtyBegin = 0;
+    unsigned int dirtyEnd = 0;
 public:
-
+    LightingManager();
     ~LightingManager();
 
     void setDirectionalLight(const DirectionalLight& directionalLight);
-    void addPointLight(const PointLight& pointLight);
+    // Lights get a shadow of shadowResolution (at most the array size) while the array of the type has free layers
+    void addPointLight(const PointLight& pointLight, unsigned int shadowResolution = POINT_SHADOW_SIZE, PointShadowType shadowType = POINT_SHADOW_CUBE);
+    // Removes the last count point lights (and their shadowmaps)
+    void removePointLights(unsigned int count);
 
-    // Use ubo for lighting
+    // Ssbos for the point lights, the directional light is per frame data
     void setupGlBuffers();
 
-    // Bind for the scene draw call
-    void bind(Shader& shader, glm::vec3 bbox);
-     void configureMatrices(glm::vec3 bbox);
-    void bindDirectionalShadowMap();
+    // Configure matrices and upload changed light data, call before rendering the shadowmaps.
+    // Scene bounds are used to keep casters outside of the camera frustum in the cascades
+    void update(const glm::vec3& sceneMin, const glm::vec3& sceneMax, const ShadowCamera& camera, FrameRingBuffer& frameData);
+    // Bind for the scene draw call, the shader has to be the variant of getShaderDefines()
+    void bind(Shader& shader);
+    // Defines of the lighting shader variant (see shadows.glsl), only changes with the shadow quality or
+    // when there are no point lights or point shadows
+    const ShaderDefines& getShaderDefines() const;
+    void configureMatrices(const glm::vec3& sceneMin, const glm::vec3& sceneMax, const ShadowCamera& camera);
+    // Lights header goes to uniform binding 1 in the frame's ring region, point lights only when changed
+    void uploadGlBuffers(FrameRingBuffer& frameData);
+    void bindDirectionalShadowMap(unsigned int cascade);
     void bindPointShadowMap(unsigned int index);
+    // All scheduled faces of the cube shadows at once, viewport i has the resolution of shadow layer i
+    void bindPointShadowMaps();
+    // Hemisphere of a dual paraboloid shadow
+    void bindParaboloidShadowMap(unsigned int index, unsigned int hemisphere);
+    // GPU time of the point shadow rendering in between, feeds the scheduler
+    void beginPointShadowUpdate();
+    void endPointShadowUpdate();
     void releaseShadowMap();
+    // Prefilters the rendered cascades when the EVSM tier is used, call after rendering them
+    void filterShadowMoments();
 
     unsigned int getNumPointLights();
 
-    // For debugging
-    unsigned int& getDepthCubemap(int index);
+    // For debugging, cube map view of the point light's shadow
+    unsigned int getDepthCubemap(int index);
     const PointLight& getPointLight(int index);
+    const std::vector<PointLight>& getPointLights() const;
+    const DirectionalLight& getDirectionalLight() const;
+    // Between 1 and MAX_CASCADES
+    void setNumCascades(unsigned int numCascades);
+    void setShadowQuality(ShadowQuality quality);
+    // Milliseconds of GPU time per frame for point shadow faces
+    void setPointShadowBudget(float milliseconds);
+    // Faces of the light's shadow cube rendered this frame
+    unsigned char getScheduledShadowFaces(int index) const;
+    // Frames since the oldest face (or hemisphere) of the light's shadow was rendered
+    unsigned int getShadowAge(int index) const;
+    const ShadowUpdateStats& getShadowUpdateStats() const;
+    const std::vector<PointLightShadow>& getPointLightShadows() const;
+
+    void setPointLightPosition(int index, glm::vec3 pos);
 
-    void setPointLightPosition(int index, glm::vec3 pos) {
-        pointLights[index].position = pos;
-    }
+private:
+    // Practical split scheme with bounding sphere fitting and texel snapping
+    void configureCascades(const glm::vec3& sceneMin, const glm::vec3& sceneMax, const ShadowCamera& camera);
+    // Ranks the visible faces by screen size, distance and age and picks the ones that fit the budget
+    void schedulePointShadows(const ShadowCamera& camera);
+    void markDirty(unsigned int index);
+    void updateShaderDefines();
+    void reallocateGlBuffers(unsigned int capacity);
 };
 
 
@@ -10,6 +10,7 @@
 #include "camera.h"
 #include "scene.h"
 #include "renderer.h"
+#include "renderthread.h"
 
 
 Camera camera;
@@ -19,6 +20,9 @@ float lastFrame = 0.0f; // Time of last frame
 
 int width = 1280;
 int height = 720;
+// Current framebuffer size, forwarded to the render thread
+int framebufferWidth = width;
+int framebufferHeight = height;
 float lastX = (float)width / 2.0f;
 float lastY = (float)height / 2.0f;
 
@@ -28,8 +32,9 @@ bool ui_interaction = false;
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-    // TODO: Fix the non-default framebuffer to also be resized
-    glViewport(0, 0, width, height);
+    // GL context belongs to the render thread, viewport is updated there
+    framebufferWidth = width;
+    framebufferHeight = height;
 }
 
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
@@ -106,20 +111,8 @@ int main() {
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window);
 
-
-    int version = gladLoadGL(glfwGetProcAddress);
-    if (version == 0) {
-        printf("Failed to initialize OpenGL context\n");
-        return -1;
-    }
-
-    // Successfully loaded OpenGL
-    printf("Loaded OpenGL %d.%d\n", GLAD_VERSION_MAJOR(version), GLAD_VERSION_MINOR(version));
-
-    // Viewport and callbacks
-    glViewport(0, 0, width, height);
+    // Callbacks, the context is made current on the render thread
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPosCallback(window, mouse_callback);
@@ -130,18 +123,28 @@ int main() {
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGuiIO& io = ImGui::GetIO();
-    // Setup Platform/Renderer backends
+    // Setup Platform backend, the renderer backend is set up on the render thread
     ImGui_ImplGlfw_InitForOpenGL(window, true);          // Second param install_callback=true will install GLFW callbacks and chain to existing ones.
-    ImGui_ImplOpenGL3_Init();
-
-    // Scene generates cube and plane in constructor atm
-    Scene scene(&camera);
 
-    // Renderer to specify forward/deferred rendering
-    Renderer renderer(width, height, &camera);
+    // Render thread owns the GL context, scene and renderer
+    RenderThread renderThread(window, width, height);
+    if (!renderThread.start()) {
+        ImGui_ImplGlfw_Shutdown();
+        ImGui::DestroyContext();
+        glfwTerminate();
+        return -1;
+    }
 
+    RenderSettings settings;
+    // From the last packet the render thread released
+    ShadowUpdateStats shadowStats;
+    UniformStats uniformStats;
+    float cullingAspect = (float)width / (float)height;
     while (!glfwWindowShouldClose(window))
     {
+        // check and call events
+        glfwPollEvents();
+
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
@@ -149,14 +152,9 @@ int main() {
         processInput(window);
 
         // Start the Dear ImGui frame
-        ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
-        static bool screen_blur = false;
-        static bool visualize_normals = false;
-        static float gamma = 2.2f;
-        static float exposure = 1.0f;
         static glm::mat3 temp_kernel(
             0, 0, 0,
             0, 1, 0,
@@ -165,72 +163,73 @@ int main() {
 
         ImGui::Begin("Render options");
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
-        if (ImGui::Checkbox("Visualize Normals", &visualize_normals)) {
-            scene.setVisualizeNormals(visualize_normals);
-        }
-        if (ImGui::SliderFloat("Gamma Correction", &gamma, 0.0f, 5.0f)) {
-            renderer.setGamma(gamma);
-        }
-        if (ImGui::SliderFloat("HDR Exposure", &exposure, 0.0f, 10.0f)) {
-            renderer.setExposure(exposure);
-        }
+        ImGui::Checkbox("Visualize Normals", &settings.visualizeNormals);
+        ImGui::SliderFloat("Gamma Correction", &settings.gamma, 0.0f, 5.0f);
+        ImGui::SliderFloat("HDR Exposure", &settings.exposure, 0.0f, 10.0f);
 
         // testing pbr
-        static float metallic = 0.0;
-        static float roughness = 0.025f;
-        static float ao = 1.0f;
-        if (ImGui::SliderFloat("metallic", &metallic, 0.0f, 1.0f)) {
-            scene.stanford_dragon->setMetallic(metallic);
-        }
-        if (ImGui::SliderFloat("roughness", &roughness, 0.0f, 1.0f)) {
-            scene.stanford_dragon->setRoughness(roughness);
-        }
-        if (ImGui::SliderFloat("ao", &ao, 0.0f, 1.0f)) {
-            scene.stanford_dragon->setAO(ao);
-        }
-        
-        static float lightPosX = 0.5f;
-        static float lightPosY = 0.25f;
-        static float lightPosZ = 0.875f;
-        if (ImGui::SliderFloat("light x", &lightPosX, -5.0f, 5.0f)) {
-            scene.lightingManager.setPointLightPosition(0, glm::vec3(lightPosX, lightPosY, lightPosZ));
-        }
-        if (ImGui::SliderFloat("light y", &lightPosY, -5.0f, 5.0f)) {
-            scene.lightingManager.setPointLightPosition(0, glm::vec3(lightPosX, lightPosY, lightPosZ));
-        }
-        if (ImGui::SliderFloat("light z", &lightPosZ, -5.0f, 5.0f)) {
-            scene.lightingManager.setPointLightPosition(0, glm::vec3(lightPosX, lightPosY, lightPosZ));
-        }
-
-        static int current_render_type = RenderType::FORWARD;
-        const char* render_type_names[] = { "Deferred", "Forward", "Debug Depth Cubemap", "Debug Irradiance Cubemap", "Debug Irradiance BRDF LUT" };
+        ImGui::SliderFloat("metallic", &settings.metallic, 0.0f, 1.0f);
+        ImGui::SliderFloat("roughness", &settings.roughness, 0.0f, 1.0f);
+        ImGui::SliderFloat("ao", &settings.ao, 0.0f, 1.0f);
+
+        ImGui::SliderFloat("light x", &settings.lightPosition.x, -5.0f, 5.0f);
+        ImGui::SliderFloat("light y", &settings.lightPosition.y, -5.0f, 5.0f);
+        ImGui::SliderFloat("light z", &settings.lightPosition.z, -5.0f, 5.0f);
+        ImGui::SliderInt("Shadow cascades", &settings.numCascades, 1, 4);
+        int current_shadow_quality = settings.shadowQuality;
+        const char* shadow_quality_names[] = { "Hard (2x2 PCF)", "Poisson 4 taps", "Poisson 8 taps", "Poisson 16 taps", "EVSM" };
+        ImGui::SliderInt("Shadow filtering", &current_shadow_quality, 0, SHADOW_QUALITY_COUNT - 1, shadow_quality_names[current_shadow_quality]);
+        settings.shadowQuality = static_cast<ShadowQuality>(current_shadow_quality);
+        ImGui::SliderFloat("Point shadow budget (ms)", &settings.pointShadowBudget, 0.05f, 4.0f);
+        ImGui::Text("Point shadow faces %u/%u (%u invalid), %.3f ms (%.3f ms/face)", shadowStats.scheduledFaces, shadowStats.visibleFaces,
+            shadowStats.invalidFaces, shadowStats.gpuMs, shadowStats.msPerFace);
+        ImGui::Text("Point shadow age: max %u, average %.1f frames", shadowStats.maxAge, shadowStats.averageAge);
+        ImGui::Text("Uniform sets %u (%u redundant skipped, %u inactive)", uniformStats.sets, uniformStats.redundantSets, uniformStats.misses);
+
+        ImGui::SliderInt("Test lights", &settings.numTestLights, 0, 4096);
+        ImGui::Checkbox("Light count heatmap (tiled)", &settings.lightHeatmap);
+        if (settings.lightHeatmap)
+            ImGui::Text("Tiles shade up to 256 lights, magenta tiles dropped some");
+
+        int current_render_type = settings.renderType;
+        const char* render_type_names[] = { "Deferred", "Forward", "Tiled Deferred", "Debug Depth Cubemap", "Debug Irradiance SH", "Debug Irradiance BRDF LUT" };
         const char* current_render_type_name = (current_render_type >= 0 && current_render_type < RenderType::COUNT) ? render_type_names[current_render_type] : "Unknown";
         ImGui::SliderInt("Render Type", &current_render_type, 0, RenderType::COUNT - 1, current_render_type_name);
+        settings.renderType = static_cast<RenderType>(current_render_type);
+
+        ImGui::Combo("Environment", &settings.environment, ENVIRONMENT_NAMES, ENVIRONMENT_COUNT);
 
         ImGui::Text("Kernel applied in post-processing");
         ImGui::InputFloat3("R1", &temp_kernel[0][0]);
         ImGui::InputFloat3("R2", &temp_kernel[1][0]);
         ImGui::InputFloat3("R3", &temp_kernel[2][0]);
         if (ImGui::Button("Apply Kernel")) {
-            renderer.setKernel(temp_kernel);
+            settings.kernel = temp_kernel;
         }
         ImGui::End();
-
-        // Render scene with current render type
-        renderer.render(scene, static_cast<RenderType>(current_render_type));
-
-        // Render Imgui
         ImGui::Render();
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-        // check and call events and swap the buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        // Hand the frame over to the render thread
+        FramePacket* packet = renderThread.acquirePacket();
+        shadowStats = packet->shadowStats;
+        uniformStats = packet->uniformStats;
+        packet->camera = camera;
+        packet->width = framebufferWidth;
+        packet->height = framebufferHeight;
+        packet->settings = settings;
+        // Same aspect ratio as the render thread's projection, a minimized window keeps the last one
+        if (framebufferWidth > 0 && framebufferHeight > 0)
+            cullingAspect = (float)framebufferWidth / (float)framebufferHeight;
+        glm::mat4 viewProjection = camera.GetProjectionMatrix(cullingAspect) * camera.GetViewMatrix();
+        renderThread.getScene().cullItems(viewProjection, packet->visibleItems);
+        packet->ui.copy(ImGui::GetDrawData());
+        renderThread.submitPacket(packet);
     }
 
+    // Destroys the scene and renderer on the render thread
+    renderThread.stop();
 
     // terminate imgui
-    ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
     // glfw: terminate, clearing all previously allocated GLFW resources.
@@ -1,4 +1,5 @@
 #include "mesh.h"
+#include "jobsystem.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 // Optional. define TINYOBJLOADER_USE_MAPBOX_EARCUT gives robust trinagulation. Requires C++11
@@ -16,6 +17,16 @@ glm::vec3 Mesh::computeBoundingBox(glm::vec3 scale) {
     return glm::vec3(0.0f);
 }
 
+void Mesh::getTriangles(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices) const {
+    positions.clear();
+    indices.clear();
+}
+
+glm::mat4 Mesh::getModelMatrix(const glm::vec3& position, const glm::vec3& scale) const {
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    return glm::scale(model, scale);
+}
+
 
 // Screen Quad
 ScreenQuad::ScreenQuad() {
@@ -42,7 +53,7 @@ void ScreenQuad::setupGlBuffers() {
     glBindVertexArray(0);
 }
 
-void ScreenQuad::draw(Shader& shader, const glm::vec3 & position, const glm::vec3 & scale) {
+void ScreenQuad::draw(Shader& shader, unsigned int instanceCount) {
     glBindVertexArray(VAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
     glBindVertexArray(0);
@@ -89,11 +100,20 @@ glm::vec3 Cube::computeBoundingBox(glm::vec3 scale) {
     return bbox;
 }
 
+void Cube::getTriangles(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices) const {
+    positions.clear();
+    indices.clear();
+    for (const Vertex& vertex : vertices) {
+        indices.push_back((unsigned int)positions.size());
+        positions.push_back(vertex.pos);
+    }
+}
+
 
 // Skybox
 Skybox::Skybox() : Cube() { }
 
-void Skybox::draw(Shader& shader, const glm::vec3 & position, const glm::vec3 & scale) {
+void Skybox::draw(Shader& shader, unsigned int instanceCount) {
     glBindVertexArray(VAO);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
@@ -115,7 +135,7 @@ unsigned int& Skybox::getVAO() {
 
 Plane::Plane() : Cube() {}
 
-void Plane::draw(Shader& shader, const glm::vec3& position, const glm::vec3& scale) {
+void Plane::draw(Shader& shader, unsigned int instanceCount) {
     // Set material
     tex.bind(GL_TEXTURE0);
     shader.setInt("material.albedo", 0);
@@ -123,20 +143,21 @@ void Plane::draw(Shader& shader, const glm::vec3& position, const glm::vec3& sca
     shader.setFloat("material.roughness", material.roughness);
     shader.setFloat("material.ao", material.ao);
 
-    // Set Model matrix and draw
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
-    model = glm::scale(model, glm::vec3(scale) * unit_scale);
-    shader.setMat4("model", model);
     glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instanceCount);
     glBindVertexArray(0);
 }
 
+glm::mat4 Plane::getModelMatrix(const glm::vec3& position, const glm::vec3& scale) const {
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    return glm::scale(model, scale * unit_scale);
+}
+
 
 // Default Cube
 DefaultCube::DefaultCube() : Cube() {}
 
-void DefaultCube::draw(Shader& shader, const glm::vec3& position, const glm::vec3& scale) {
+void DefaultCube::draw(Shader& shader, unsigned int instanceCount) {
     // Set material
     tex.bind(GL_TEXTURE0);
     shader.setInt("material.albedo", 0);
@@ -144,13 +165,8 @@ void DefaultCube::draw(Shader& shader, const glm::vec3& position, const glm::vec
     shader.setFloat("material.roughness", material.roughness);
     shader.setFloat("material.ao", material.ao);
 
-    // Set Model matrix
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
-    model = glm::scale(model, glm::vec3(scale));
-    shader.setMat4("model", model);
-
     glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instanceCount);
     glBindVertexArray(0);
 }
 
@@ -283,12 +299,15 @@ void TriangleMesh::computeVertexNormals() {
         vertices[indices[3 * i + 2]].normal += normal;
     }
 
-    for (unsigned int i = 0; i < vertices.size(); i++) {
-        vertices[i].normal = glm::normalize(vertices[i].normal);
-    }
+    // Accumulation above scatters into shared vertices, normalization is independent per vertex
+    JobSystem::instance().parallelFor(vertices.size(), 4096, [this](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            vertices[i].normal = glm::normalize(vertices[i].normal);
+        }
+    }, "computeVertexNormals");
 }
 
-void TriangleMesh::draw(Shader& shader, const glm::vec3& position, const glm::vec3& scale) {
+void TriangleMesh::draw(Shader& shader, unsigned int instanceCount) {
     // Bind textures
     albedo.bind(GL_TEXTURE0);
     shader.setInt("material.albedo", 0);
@@ -296,12 +315,9 @@ void TriangleMesh::draw(Shader& shader, const glm::vec3& position, const glm::ve
     shader.setFloat("material.roughness", material.roughness);
     shader.setFloat("material.ao", material.ao);
 
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
-    model = glm::scale(model, glm::vec3(scale));
-    shader.setMat4("model", model);
     // draw mesh
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, instanceCount);
     glBindVertexArray(0);
 }
 
@@ -313,3 +329,11 @@ glm::vec3 TriangleMesh::computeBoundingBox(glm::vec3 scale) {
     }
     return bbox;
 }
+
+void TriangleMesh::getTriangles(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices) const {
+    positions.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        positions[i] = vertices[i].pos;
+    }
+    indices = this->indices;
+}
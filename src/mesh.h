@@ -40,10 +40,15 @@ protected:
 public:
     ~Mesh();
     virtual void setupGlBuffers() = 0;
-    virtual void draw(Shader& shader, const glm::vec3& position, const glm::vec3& scale) = 0;
+    // instanceCount > 1 is used by shaders that index per instance data themselves (e.g. layered shadows).
+    // The model matrix is per draw data bound by the caller, see getModelMatrix
+    virtual void draw(Shader& shader, unsigned int instanceCount = 1) = 0;
+    virtual glm::mat4 getModelMatrix(const glm::vec3& position, const glm::vec3& scale) const;
 
     // might be replaced after cascaded shadowmapping
     virtual glm::vec3 computeBoundingBox(glm::vec3 scale);
+    // Object space triangles for CPU ray queries, 3 indices per triangle. Empty for meshes without geometry
+    virtual void getTriangles(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices) const;
     // TEMP
     void setMetallic(float metallic) {
         this->material.metallic = metallic;
@@ -70,7 +75,7 @@ class ScreenQuad : public Mesh {
 public:
     ScreenQuad();
     void setupGlBuffers();
-    void draw(Shader& shader, const glm::vec3 & /*position*/ = glm::vec3(0.0f), const glm::vec3 & /*scale*/ = glm::vec3(1.0f));
+    void draw(Shader& shader, unsigned int /*instanceCount*/ = 1);
 
     unsigned int& getVAO();
 };
@@ -128,9 +133,10 @@ private:
 public:
     Cube();
     void setupGlBuffers();
-    virtual void draw(Shader& shader, const glm::vec3& position, const glm::vec3& scale) = 0; 
+    virtual void draw(Shader& shader, unsigned int instanceCount = 1) = 0; 
     // TODO: might be replaced/removed after cascade shadowmapping
     glm::vec3 computeBoundingBox(glm::vec3 scale);
+    void getTriangles(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices) const;
 };
 
 
@@ -150,7 +156,7 @@ public:
     Skybox();
 
     // Ignoring position and scale because skybox
-    void draw(Shader& shader, const glm::vec3 & /*position*/ = glm::vec3(0.0f), const glm::vec3 & /*scale*/ = glm::vec3(1.0f));
+    void draw(Shader& shader, unsigned int /*instanceCount*/ = 1);
 
     const glm::mat4& getProjectionMatrix();
     const glm::mat4& getViewMatrix(int index);
@@ -166,7 +172,8 @@ private:
     glm::vec3 unit_scale = glm::vec3(1.0f, 0.01f, 1.0f);
 public:
     Plane();
-    void draw(Shader& shader, const glm::vec3& position, const glm::vec3& scale);
+    void draw(Shader& shader, unsigned int instanceCount = 1);
+    glm::mat4 getModelMatrix(const glm::vec3& position, const glm::vec3& scale) const;
 };
 
 // Default cube with material
@@ -175,7 +182,7 @@ private:
     Texture tex = Texture("../resources/white.png");
 public:
     DefaultCube();
-    void draw(Shader& shader, const glm::vec3& position, const glm::vec3& scale);
+    void draw(Shader& shader, unsigned int instanceCount = 1);
 };
 
 // Uses https://github.com/tinyobjloader/tinyobjloader
@@ -200,8 +207,9 @@ public:
 
     void setupGlBuffers();
     glm::vec3 computeBoundingBox(glm::vec3 scale);
+    void getTriangles(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices) const;
 
-    void draw(Shader& shader, const glm::vec3& position, const glm::vec3& scale);
+    void draw(Shader& shader, unsigned int instanceCount = 1);
 
 };
 
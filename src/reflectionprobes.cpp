@@ -0,0 +1,213 @@
+#include "reflectionprobes.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+ReflectionProbes::ReflectionProbes() {
+    glGenTextures(1, &probeMaps);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, probeMaps);
+    glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, PREFILTER_MIP_LEVELS, GL_RGBA16F, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE, MAX_REFLECTION_PROBES * 6);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Views need immutable storage, every view covers the 6 layer-faces of one probe
+    probeViews.resize(MAX_REFLECTION_PROBES);
+    glGenTextures(MAX_REFLECTION_PROBES, probeViews.data());
+    for (unsigned int i = 0; i < MAX_REFLECTION_PROBES; i++) {
+        glTextureView(probeViews[i], GL_TEXTURE_CUBE_MAP, probeMaps, GL_RGBA16F, 0, PREFILTER_MIP_LEVELS, i * 6, 6);
+    }
+
+    unsigned int captureLevels = 1;
+    for (unsigned int size = REFLECTION_PROBE_SIZE; size > 1; size >>= 1)
+        captureLevels++;
+    glGenTextures(1, &captureCubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, captureCubemap);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, captureLevels, GL_RGBA16F, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glGenFramebuffers(1, &captureFBO);
+    glGenRenderbuffers(1, &captureRBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(1, &ssboProbes);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboProbes);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_REFLECTION_PROBES * sizeof(GpuReflectionProbe), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+ReflectionProbes::~ReflectionProbes() {
+    glDeleteTextures(MAX_REFLECTION_PROBES, probeViews.data());
+    glDeleteTextures(1, &probeMaps);
+    glDeleteTextures(1, &captureCubemap);
+    glDeleteFramebuffers(1, &captureFBO);
+    glDeleteRenderbuffers(1, &captureRBO);
+    glDeleteBuffers(1, &ssboProbes);
+}
+
+int ReflectionProbes::addProbe(const ReflectionProbe& probe) {
+    if (probes.size() >= MAX_REFLECTION_PROBES)
+        return -1;
+
+    probes.push_back(probe);
+    dirty.push_back(true);
+    valid.push_back(false);
+    return (int)probes.size() - 1;
+}
+
+void ReflectionProbes::setProbe(unsigned int index, const ReflectionProbe& probe) {
+    probes[index] = probe;
+    dirty[index] = true;
+    buffersDirty = true;
+}
+
+unsigned int ReflectionProbes::getNumProbes() const {
+    return (unsigned int)probes.size();
+}
+
+void ReflectionProbes::invalidate() {
+    // A probe in the middle of an update finishes with the old capture and is captured again afterwards
+    for (unsigned int i = 0; i < probes.size(); i++)
+        dirty[i] = true;
+}
+
+void ReflectionProbes::setBudget(float milliseconds) {
+    budgetMs = milliseconds;
+}
+
+void ReflectionProbes::update(const ProbeCaptureFunction& capture) {
+    // Query results arrive a few frames late, keep a running cost per step
+    double milliseconds;
+    while (updateTimer.getResult(milliseconds)) {
+        unsigned int steps = timedStepCounts.front();
+        timedStepCounts.pop_front();
+        if (steps > 0)
+            msPerStep = glm::mix(msPerStep, (float)milliseconds / steps, 0.25f);
+    }
+
+    // As many steps as fit the budget, at least one so the probes are done eventually
+    unsigned int budgetSteps = (unsigned int)glm::max(budgetMs / glm::max(msPerStep, 0.001f), 1.0f);
+    bool timing = false;
+    unsigned int steps = 0;
+    while (steps < budgetSteps) {
+        if (updatingProbe < 0) {
+            for (unsigned int i = 0; i < probes.size() && updatingProbe < 0; i++) {
+                if (dirty[i])
+                    updatingProbe = i;
+            }
+            if (updatingProbe < 0)
+                break;
+            // Cleared at the start, so probes invalidated during the update are captured again
+            dirty[updatingProbe] = false;
+            updateStep = 0;
+        }
+        if (steps == 0)
+            timing = updateTimer.begin();
+
+        if (updateStep < CAPTURE_STEPS)
+            this->captureFace(updateStep, capture);
+        else
+            this->prefilterLevel(updatingProbe, updateStep - CAPTURE_STEPS);
+        steps++;
+        updateStep++;
+
+        if (updateStep == UPDATE_STEPS) {
+            valid[updatingProbe] = true;
+            buffersDirty = true;
+            updatingProbe = -1;
+        }
+    }
+    if (timing) {
+        updateTimer.end();
+        timedStepCounts.push_back(steps);
+    }
+
+    if (buffersDirty)
+        this->uploadGlBuffers();
+}
+
+void ReflectionProbes::captureFace(unsigned int face, const ProbeCaptureFunction& capture) {
+    // GL cube map face order and orientation
+    static const glm::vec3 targets[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+    static const glm::vec3 ups[6] = {
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+        glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+    };
+    const ReflectionProbe& probe = probes[updatingProbe];
+
+    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, captureCubemap, 0);
+    glViewport(0, 0, REFLECTION_PROBE_SIZE, REFLECTION_PROBE_SIZE);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, REFLECTION_PROBE_NEAR, REFLECTION_PROBE_FAR);
+    glm::mat4 view = glm::lookAt(probe.position, probe.position + targets[face], ups[face]);
+    capture(projection, view, probe.position);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Mips for the filtered importance sampling of the prefilter steps
+    if (face == CAPTURE_STEPS - 1) {
+        glBindTexture(GL_TEXTURE_CUBE_MAP, captureCubemap);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    }
+}
+
+void ReflectionProbes::prefilterLevel(unsigned int probe, unsigned int level) {
+    prefilterShader.use();
+    prefilterShader.setInt("environmentMap", 0);
+    prefilterShader.setFloat("environmentSize", (float)REFLECTION_PROBE_SIZE);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, captureCubemap);
+
+    // Same roughness levels as the environment's prefiltered map, all 6 faces of the level in one dispatch
+    unsigned int mipSize = REFLECTION_PROBE_SIZE >> level;
+    float roughness = (float)level / (float)(PREFILTER_MIP_LEVELS - 1);
+    prefilterShader.setFloat("roughness", roughness);
+    prefilterShader.setInt("sampleCount", PREFILTER_SAMPLE_COUNTS[level]);
+    glBindImageTexture(0, probeViews[probe], level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glDispatchCompute((mipSize + 7) / 8, (mipSize + 7) / 8, 6);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void ReflectionProbes::uploadGlBuffers() {
+    // Only probes with a prefiltered map, layer keeps their place in the array
+    std::vector<GpuReflectionProbe> gpuProbes;
+    for (unsigned int i = 0; i < probes.size(); i++) {
+        if (!valid[i])
+            continue;
+        const ReflectionProbe& probe = probes[i];
+        GpuReflectionProbe gpuProbe;
+        gpuProbe.positionRadius = glm::vec4(probe.position, probe.radius);
+        gpuProbe.extentsBlend = glm::vec4(probe.extents, glm::max(probe.blendDistance, 0.001f));
+        gpuProbe.layer = i;
+        gpuProbes.push_back(gpuProbe);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboProbes);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuProbes.size() * sizeof(GpuReflectionProbe), gpuProbes.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    numGpuProbes = (unsigned int)gpuProbes.size();
+    buffersDirty = false;
+}
+
+void ReflectionProbes::bind(Shader& shader) {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, ssboProbes);
+    shader.setInt("numReflectionProbes", numGpuProbes);
+
+    glActiveTexture(GL_TEXTURE13);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, probeMaps);
+    shader.setInt("reflectionProbeMaps", 13);
+}
@@ -0,0 +1,110 @@
+#ifndef REFLECTION_PROBES_H
+#define REFLECTION_PROBES_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "gputimer.h"
+#include "irradiancemap.h"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Probes of the cube map array
+const unsigned int MAX_REFLECTION_PROBES = 16;
+// Face size of the captures and the prefiltered maps, the maps have PREFILTER_MIP_LEVELS roughness levels
+const unsigned int REFLECTION_PROBE_SIZE = 128;
+// GPU time per frame spent on capturing and prefiltering probes
+const float REFLECTION_PROBE_BUDGET_MS = 0.5f;
+const float REFLECTION_PROBE_NEAR = 0.05f;
+const float REFLECTION_PROBE_FAR = 50.0f;
+
+// Where a probe's reflections are used, they fade out over blendDistance towards the border.
+// Reflections are parallax corrected against the same box or sphere
+struct ReflectionProbe {
+    glm::vec3 position;
+    // Box half size, ignored for spheres
+    glm::vec3 extents;
+    // Sphere radius, 0 for a box
+    float radius;
+    float blendDistance;
+};
+
+// Probe as read by reflection_probes.glsl (std430)
+struct GpuReflectionProbe {
+    // xyz position, w sphere radius (0 for a box)
+    glm::vec4 positionRadius;
+    // xyz box half size, w blend distance
+    glm::vec4 extentsBlend;
+    // Cube map of the probe in the array
+    int layer;
+    int padding[3];
+};
+
+// Draws the scene into the bound framebuffer for a capture face, the viewport is set
+typedef std::function<void(const glm::mat4& projection, const glm::mat4& view, const glm::vec3& position)> ProbeCaptureFunction;
+
+// Placeable probes with prefiltered cube maps in a cube map array. Captures are cached, a probe is only
+// captured again after it moved or was invalidated. Updates are split into steps (one face capture or one
+// roughness level) and each frame only runs as many steps as fit the budget, like the point shadows
+class ReflectionProbes {
+private:
+    std::vector<ReflectionProbe> probes;
+    // Needs a new capture, the prefiltered map keeps the old one until then
+    std::vector<bool> dirty;
+    // Has been prefiltered once, invalid probes are not uploaded
+    std::vector<bool> valid;
+
+    // Prefiltered maps, probe i is cube map (layer) i
+    unsigned int probeMaps = 0;
+    // Cube map views of single probes, so the prefilter shader writes them like any cube map
+    std::vector<unsigned int> probeViews;
+    // Capture of the probe being updated, with mips for the filtered importance sampling
+    unsigned int captureCubemap = 0;
+    unsigned int captureFBO = 0, captureRBO = 0;
+    Shader prefilterShader = Shader("prefilter_convolution.comp");
+
+    unsigned int ssboProbes;
+    // Probes in the buffer, the valid ones
+    unsigned int numGpuProbes = 0;
+    bool buffersDirty = true;
+    // Probe being updated and its next step, -1 when no probe is
+    int updatingProbe = -1;
+    unsigned int updateStep = 0;
+
+    float budgetMs = REFLECTION_PROBE_BUDGET_MS;
+    float msPerStep = 0.1f;
+    GpuTimer updateTimer;
+    std::deque<unsigned int> timedStepCounts;
+
+    // Steps of one update, 6 face captures then one dispatch per roughness level
+    static const unsigned int CAPTURE_STEPS = 6;
+    static const unsigned int UPDATE_STEPS = CAPTURE_STEPS + PREFILTER_MIP_LEVELS;
+
+    void captureFace(unsigned int face, const ProbeCaptureFunction& capture);
+    void prefilterLevel(unsigned int probe, unsigned int level);
+    void uploadGlBuffers();
+
+public:
+    ReflectionProbes();
+    ~ReflectionProbes();
+
+    // Returns the probe index, -1 once MAX_REFLECTION_PROBES are placed
+    int addProbe(const ReflectionProbe& probe);
+    // Moving a probe captures it again
+    void setProbe(unsigned int index, const ReflectionProbe& probe);
+    unsigned int getNumProbes() const;
+    // Captures all probes again, e.g. after the environment or the lighting changed
+    void invalidate();
+    void setBudget(float milliseconds);
+
+    // Runs the update steps that fit the budget, the capture function draws the scene for one face
+    void update(const ProbeCaptureFunction& capture);
+    // Probe buffer (binding 8), numReflectionProbes and the map array (unit 13)
+    void bind(Shader& shader);
+};
+
+
+#endif
@@ -2,19 +2,34 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+
+// Variant of the probe captures, the clusters are only built for the camera
+static ShaderDefines probeCaptureDefines(const ShaderDefines& lightingDefines) {
+	ShaderDefines defines = lightingDefines;
+	if (std::find(defines.begin(), defines.end(), "NO_POINT_LIGHTS true") == defines.end())
+		defines.push_back("NO_POINT_LIGHTS true");
+	return defines;
+}
+
 Renderer::Renderer(unsigned int width, unsigned int height, Camera* camera) : width(width), height(height), camera(camera) {
 	// not sure where to put this
 	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
-	this->setupMatrices();
-
 	this->setupDeferredResources();
 	this->setupPostProcResources();
 
 	this->setupDebugCubemapResources();
+
+	// The first environment is loaded before the first frame
+	irradianceMap = std::make_unique<IrradianceMap>(ENVIRONMENT_PATHS[0]);
 }
 
 Renderer::~Renderer() {
+	this->deleteFramebuffers();
+}
+
+void Renderer::deleteFramebuffers() {
 	// Clean up deferred rendering
 	glDeleteFramebuffers(1, &gBuffer);
 	glDeleteTextures(1, &gPosition);
@@ -28,13 +43,20 @@ Renderer::~Renderer() {
 	glDeleteRenderbuffers(1, &screenRbo);
 }
 
-void Renderer::render(Scene& scene, RenderType renderType) {
+void Renderer::render(Scene& scene, RenderType renderType, const std::vector<unsigned int>& visibleItems) {
+	// Waits until the GPU is done with the region written three frames ago
+	scene.frameData.beginFrame();
+	this->updateEnvironment(scene);
+
 	switch (renderType) {
 	case RenderType::DEFERRED:
-		this->deferred(scene);
+		this->deferred(scene, visibleItems);
 		break;
 	case RenderType::FORWARD:
-		this->forward(scene);
+		this->forward(scene, visibleItems);
+		break;
+	case RenderType::TILED_DEFERRED:
+		this->tiledDeferred(scene, visibleItems);
 		break;
 	case RenderType::DEBUG_DEPTH_CUBEMAP:
 		this->debugDepthCubemap(scene);
@@ -48,6 +70,20 @@ void Renderer::render(Scene& scene, RenderType renderType) {
 	default:
 		std::cerr << "Rendering Type does not exist" << std::endl;
 	};
+
+	scene.frameData.endFrame();
+}
+
+void Renderer::resize(unsigned int width, unsigned int height) {
+	// Minimized windows have an empty framebuffer, keep the old targets until there is something to render to
+	if (width == 0 || height == 0 || (width == this->width && height == this->height))
+		return;
+
+	this->width = width;
+	this->height = height;
+	this->deleteFramebuffers();
+	this->setupDeferredResources();
+	this->setupPostProcResources();
 }
 
 void Renderer::setGamma(float gamma) {
@@ -62,28 +98,98 @@ void Renderer::setKernel(glm::mat3 kernel) {
 	this->kernel = kernel;
 }
 
-// Refers to projection and view matrices
-void Renderer::setupMatrices() {
-	glGenBuffers(1, &uboMatrices);
+void Renderer::setLightHeatmap(bool lightHeatmap) {
+	this->lightHeatmap = lightHeatmap;
+}
 
-	glBindBuffer(GL_UNIFORM_BUFFER, uboMatrices);
-	glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), NULL, GL_STATIC_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+void Renderer::setEnvironment(const std::string& filepath) {
+	if (nextIrradianceMap && nextIrradianceMap->getPath() == filepath)
+		return;
+	if (irradianceMap->getPath() == filepath) {
+		// Switched back before the other one was done
+		nextIrradianceMap.reset();
+		return;
+	}
+
+	nextIrradianceMap = std::make_unique<IrradianceMap>();
+	nextIrradianceMap->startLoading(filepath);
+}
 
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, uboMatrices, 0, 2 * sizeof(glm::mat4));
+void Renderer::updateEnvironment(Scene& scene) {
+	if (nextIrradianceMap) {
+		if (nextIrradianceMap->continueLoading(ENVIRONMENT_LOAD_BUDGET_MS)) {
+			// All maps and the irradiance change in the same frame
+			irradianceMap = std::move(nextIrradianceMap);
+			// The probes keep reflecting the old environment until they are captured again
+			scene.reflectionProbes.invalidate();
+		}
+		else if (nextIrradianceMap->hasFailed()) {
+			// Keeps the current environment, selecting the same file again retries
+			nextIrradianceMap.reset();
+		}
+	}
+
+	// Baked for the first environment and again for every new one
+	if (bakedEnvironment != irradianceMap.get()) {
+		scene.bakeIrradianceVolume(irradianceMap->getIrradianceSH());
+		bakedEnvironment = irradianceMap.get();
+	}
+	scene.irradianceVolume.update();
 }
 
-void Renderer::updateMatrices() {
+void Renderer::warmUpShaders(Scene& scene) {
+	scene.warmUpShaders();
+	geometryPassShader.submit();
+	screenShader.submit();
+	skyboxShader.submit();
+	std::vector<ShaderDefines> variants = { scene.lightingManager.getShaderDefines() };
+	deferredLightingShaders.warmUp(variants);
+	tiledDeferredShaders.warmUp(variants);
+	variants.push_back(probeCaptureDefines(scene.lightingManager.getShaderDefines()));
+	pbrShaders.warmUp(variants);
+}
+
+void Renderer::updateReflectionProbes(Scene& scene) {
+	// The fallback variant would shade the captures with the point lights, whose clusters are only valid for the
+	// camera. The probes keep their last capture until the variant is compiled
+	Shader* capture = pbrShaders.getIfReady(probeCaptureDefines(scene.lightingManager.getShaderDefines()));
+	if (!capture)
+		return;
+	Shader& captureShader = *capture;
+	scene.reflectionProbes.update([&](const glm::mat4& projection, const glm::mat4& view, const glm::vec3& position) {
+		glm::mat4 matrices[2] = { projection, view };
+		scene.frameData.bindUniform(0, matrices, sizeof(matrices));
+		glEnable(GL_DEPTH_TEST);
+
+		captureShader.use();
+		irradianceMap->bind(captureShader);
+		captureShader.setVec3("viewPos", position);
+		scene.bindLightsData(captureShader);
+		// Reflections of other probes from their last capture
+		scene.reflectionProbes.bind(captureShader);
+		scene.irradianceVolume.bind(captureShader);
+		std::vector<unsigned int> visibleItems;
+		scene.cullItems(projection * view, visibleItems);
+		scene.draw(captureShader, visibleItems);
+
+		glDepthFunc(GL_LEQUAL);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap->getEnvironmentMap());
+		skyboxShader.use();
+		skyboxShader.setInt("skybox", 0);
+		skybox.draw(skyboxShader);
+		glDepthFunc(GL_LESS);
+	});
+}
+
+// Projection and view matrices (uniform binding 0) in the frame's ring region
+void Renderer::updateMatrices(Scene& scene) {
 	// view/projection transformations
-	glm::mat4 projection = glm::perspective(glm::radians(camera->Zoom), (float)width / (float)height, 0.1f, 100.0f);
-	glm::mat4 view = camera->GetViewMatrix();
-
-	glBindBuffer(GL_UNIFORM_BUFFER, uboMatrices);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(projection));
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	glBindBuffer(GL_UNIFORM_BUFFER, uboMatrices);
-	glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(view));
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	projection = camera->GetProjectionMatrix((float)width / (float)height);
+	view = camera->GetViewMatrix();
+
+	glm::mat4 matrices[2] = { projection, view };
+	scene.frameData.bindUniform(0, matrices, sizeof(matrices));
 }
 
 // g buffer
@@ -137,16 +243,16 @@ void Renderer::setupDeferredResources() {
 
 
 
-// Simple deferred rendering
-void Renderer::deferred(Scene& scene) {
+// Shadow maps and filling the g buffer
+void Renderer::geometryPass(Scene& scene, const std::vector<unsigned int>& visibleItems) {
 	// First shadow map then normal rendering passes
-	scene.computeShadowMaps();
+	scene.computeShadowMaps((float)width / (float)height);
 
 	//Reset viewport size
 	glViewport(0, 0, width, height);
 
 	// Update 
-	this->updateMatrices();
+	this->updateMatrices(scene);
 
 	// geometry pass
 	glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
@@ -154,9 +260,27 @@ void Renderer::deferred(Scene& scene) {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	geometryPassShader.use();
-	scene.draw(geometryPassShader);
+	scene.draw(geometryPassShader, visibleItems);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void Renderer::forwardAfterDeferred(Scene& scene) {
+	// Copy Depth buffer from g-Buffer
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFbo); // write to default framebuffer
+	glBlitFramebuffer(
+		0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST
+	);
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+
+	// Special shader drawings
+	scene.specialShadersDraw();
+}
+
+// Simple deferred rendering
+void Renderer::deferred(Scene& scene, const std::vector<unsigned int>& visibleItems) {
+	this->geometryPass(scene, visibleItems);
 
 	// deferred lighting pass
 	// Second pass
@@ -171,6 +295,7 @@ void Renderer::deferred(Scene& scene) {
 	glActiveTexture(GL_TEXTURE2);
 	glBindTexture(GL_TEXTURE_2D, gAlbedoSpec);
 
+	Shader& deferredLightingShader = deferredLightingShaders.get(scene.lightingManager.getShaderDefines());
 	deferredLightingShader.use();
 	deferredLightingShader.setInt("gPosition", 0);
 	deferredLightingShader.setInt("gNormal", 1);
@@ -184,28 +309,55 @@ void Renderer::deferred(Scene& scene) {
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 
 	// FORWARD RENDERING PART
-	// Copy Depth buffer from g-Buffer
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFbo); // write to default framebuffer
-	glBlitFramebuffer(
-		0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST
-	);
-	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
+	this->forwardAfterDeferred(scene);
 
-	// Special shader drawings
-	scene.specialShadersDraw();
+	this->postProcess();
+}
+
+// Tiled deferred rendering, lights are culled per 16x16 tile against the tile depth bounds
+void Renderer::tiledDeferred(Scene& scene, const std::vector<unsigned int>& visibleItems) {
+	this->geometryPass(scene, visibleItems);
+
+	// lighting pass writes the screen color buffer directly
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, gPosition);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, gNormal);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, gAlbedoSpec);
+	glBindImageTexture(0, screenColorbuffer, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+	Shader& tiledDeferredShader = tiledDeferredShaders.get(scene.lightingManager.getShaderDefines());
+	tiledDeferredShader.use();
+	tiledDeferredShader.setInt("gPosition", 0);
+	tiledDeferredShader.setInt("gNormal", 1);
+	tiledDeferredShader.setInt("gAlbedoSpec", 2);
+	tiledDeferredShader.setVec3("viewPos", camera->Position);
+	tiledDeferredShader.setMat4("invProjection", glm::inverse(projection));
+	tiledDeferredShader.setBool("showLightHeatmap", lightHeatmap);
+	// Bind shadowmap data
+	scene.bindLightsData(tiledDeferredShader);
+
+	glDispatchCompute((width + TILE_SIZE - 1) / TILE_SIZE, (height + TILE_SIZE - 1) / TILE_SIZE, 1);
+	// Image writes have to be visible to the forward pass and post-processing
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	// FORWARD RENDERING PART
+	this->forwardAfterDeferred(scene);
 
 	this->postProcess();
 }
 
-void Renderer::forward(Scene& scene) {
+void Renderer::forward(Scene& scene, const std::vector<unsigned int>& visibleItems) {
 	// First shadow map then normal rendering passes
-	scene.computeShadowMaps();
+	scene.computeShadowMaps((float)width / (float)height);
+	this->updateReflectionProbes(scene);
 
 	//Reset viewport size
 	glViewport(0, 0, width, height);
 
-	this->updateMatrices();
+	this->updateMatrices(scene);
+	clusteredLights.update(projection, view, NEAR_PLANE, FAR_PLANE, scene.lightingManager.getPointLights());
 
 	// first pass
 	glBindFramebuffer(GL_FRAMEBUFFER, screenFbo);
@@ -213,19 +365,23 @@ void Renderer::forward(Scene& scene) {
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
+	Shader& pbrShader = pbrShaders.get(scene.lightingManager.getShaderDefines());
 	pbrShader.use();
-	irradianceMap.bind(pbrShader);
+	irradianceMap->bind(pbrShader);
 	pbrShader.setVec3("viewPos", camera->Position);
 	
 	// Bind lights and shadowmap data
 	scene.bindLightsData(pbrShader);
+	clusteredLights.bind(pbrShader, width, height);
+	scene.reflectionProbes.bind(pbrShader);
+	scene.irradianceVolume.bind(pbrShader);
 	// Draw scene with PBR shader
-	scene.draw(pbrShader);
+	scene.draw(pbrShader, visibleItems);
 
 	// Draw used HDR environment map as skybox
 	glDepthFunc(GL_LEQUAL);
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap.getEnvironmentMap());
+	glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap->getEnvironmentMap());
 	skyboxShader.use();
 	skyboxShader.setInt("skybox", 0);
 	skybox.draw(skyboxShader);
@@ -300,13 +456,13 @@ void Renderer::setupDebugCubemapResources() {
 
 void Renderer::debugDepthCubemap(Scene& scene) {
 	// First shadow map then normal rendering passes
-	scene.computeShadowMaps();
+	scene.computeShadowMaps((float)width / (float)height);
 	//Reset viewport size
 	glViewport(0, 0, width, height);
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	this->updateMatrices();
+	this->updateMatrices(scene);
 
 	// draw skybox as last
 	glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
@@ -327,15 +483,14 @@ void Renderer::debugIrradiancemap(Scene& scene) {
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	this->updateMatrices();
+	this->updateMatrices(scene);
 
 	// draw skybox as last
 	glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
-	skyboxShader.use();
+	skyboxIrradianceShader.use();
+	irradianceMap->setIrradianceSH(skyboxIrradianceShader);
 	// skybox cube
 	glBindVertexArray(skybox.getVAO());
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap.getIrradianceMap());
 	glDrawArrays(GL_TRIANGLES, 0, 36);
 	glBindVertexArray(0);
 	glDepthFunc(GL_LESS); // set depth function back to default
@@ -357,7 +512,7 @@ void Renderer::debugBrdfLUT(Scene& scene) {
 	screenShader.setFloat("gamma", gamma);
 	glBindVertexArray(quad.getVAO());
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, irradianceMap.getBrdfLUT());
+	glBindTexture(GL_TEXTURE_2D, irradianceMap->getBrdfLUT());
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 
 	//glDisable(GL_FRAMEBUFFER_SRGB);
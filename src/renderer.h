@@ -6,19 +6,29 @@
 
 #include "scene.h"
 #include "shader.h"
+#include "shadervariants.h"
 #include "camera.h"
 #include "irradiancemap.h"
+#include "clusteredlights.h"
+
+#include <memory>
 
 
 enum RenderType {
 	DEFERRED,
 	FORWARD,
+	TILED_DEFERRED,
 	DEBUG_DEPTH_CUBEMAP,
 	DEBUG_IRRADIANCE_CUBEMAP,
 	DEBUG_BRDF_LUT,
 	COUNT // only for the count
 };
 
+// HDR environments that can be switched at runtime
+const char* const ENVIRONMENT_NAMES[] = { "Newport Loft", "Winter Forest" };
+const char* const ENVIRONMENT_PATHS[] = { "../resources/newport_loft.hdr", "../resources/Winter_Forest/WinterForest_Env.hdr" };
+const int ENVIRONMENT_COUNT = 2;
+
 class Renderer {
 private:
 	Camera* camera;
@@ -26,7 +36,12 @@ private:
 
 	// G Buffer shader
 	Shader geometryPassShader = Shader("g_buffer.vert", "g_buffer.frag");
-	Shader deferredLightingShader = Shader("deferred_lighting.vert", "deferred_lighting.frag");
+	// Lighting shaders are specialized to LightingManager::getShaderDefines()
+	ShaderVariants deferredLightingShaders = ShaderVariants("deferred_lighting.vert", "deferred_lighting.frag");
+	// Tiled deferred lighting compute shader
+	ShaderVariants tiledDeferredShaders = ShaderVariants("tiled_deferred.comp");
+	// Pixels per side of a tile, matches TILE_SIZE in tiled_deferred.comp
+	const unsigned int TILE_SIZE = 16;
 
 	// Forward screen shader
 	Shader screenShader = Shader("screen.vert", "screen.frag");
@@ -35,10 +50,15 @@ private:
 	Shader blinnPhongShader = Shader("blinn_phong.vert", "blinn_phong.frag");
 
 	// PBR shader
-	Shader pbrShader = Shader("pbr.vert", "pbr.frag");
+	ShaderVariants pbrShaders = ShaderVariants("pbr.vert", "pbr.frag");
+
+	// Point lights per cluster for the forward shader
+	ClusteredLights clusteredLights;
 
 	// Debug skybox shader
 	Shader skyboxShader = Shader("skybox.vert", "skybox.frag");
+	// Evaluates the spherical harmonics irradiance per direction
+	Shader skyboxIrradianceShader = Shader("skybox.vert", "skybox_irradiance.frag");
 
 	// Meshes
 	ScreenQuad quad;
@@ -54,12 +74,17 @@ private:
 		0, 1, 0,
 		0, 0, 0
 	);
+	// Overlay the light count per tile in tiled deferred
+	bool lightHeatmap = false;
 
-	IrradianceMap irradianceMap = IrradianceMap("../resources/newport_loft.hdr");
-	//IrradianceMap irradianceMap = IrradianceMap("../resources/Winter_Forest/WinterForest_Env.hdr");
+	// Environment in use and the one loading in the background, swapped in once all of its maps are complete
+	std::unique_ptr<IrradianceMap> irradianceMap;
+	std::unique_ptr<IrradianceMap> nextIrradianceMap;
+	// Environment the scene's irradiance volume was last baked with
+	const IrradianceMap* bakedEnvironment = nullptr;
 
-	// GL variables
-	unsigned int uboMatrices;
+	// Last uploaded matrices
+	glm::mat4 projection, view;
 
 	// Deferred rendering GL variables
 	unsigned int gBuffer;
@@ -78,25 +103,47 @@ public:
 	Renderer(unsigned int width, unsigned int height, Camera* camera);
 	~Renderer();
 
-	void render(Scene& scene, RenderType renderType);
+	// visibleItems are the scene items drawn by the camera passes, shadow passes draw all items
+	void render(Scene& scene, RenderType renderType, const std::vector<unsigned int>& visibleItems);
+	// Submits the shaders and the lighting variants of the current lights for compiling ahead of the first frame,
+	// so the driver compiles them in parallel
+	void warmUpShaders(Scene& scene);
+	// Recreates the G-buffer and the post-processing framebuffer for a new framebuffer size
+	void resize(unsigned int width, unsigned int height);
 
 	void setGamma(float gamma);
 	void setExposure(float exposure);
 	void setKernel(glm::mat3 kernel);
+	void setLightHeatmap(bool lightHeatmap);
+	// Starts loading the HDR environment in the background, the current one is used until that is done
+	void setEnvironment(const std::string& filepath);
 
 private:
-	// Refers to projection and view matrices
-	void setupMatrices();
-	void updateMatrices();
+	// Spends the frame's budget on the next environment and swaps it in when it is complete, rebakes the irradiance
+	// volume for a new environment and uploads finished bakes
+	void updateEnvironment(Scene& scene);
+	// Runs the reflection probe updates that fit their budget, captures use the forward PBR shader
+	void updateReflectionProbes(Scene& scene);
+	// Projection and view matrices, written to the scene's per frame data
+	void updateMatrices(Scene& scene);
 	//void setupScreenQuad();
 
+	// G-buffer and post-processing framebuffer with their attachments
+	void deleteFramebuffers();
+
 	// g buffer
 	void setupDeferredResources();
 	// Simple deferred rendering
-	void deferred(Scene& scene);
+	void deferred(Scene& scene, const std::vector<unsigned int>& visibleItems);
+	// Shadow maps and filling the g buffer, shared by the deferred paths
+	void geometryPass(Scene& scene, const std::vector<unsigned int>& visibleItems);
+	// Copy depth of the g buffer and draw the forward rendered objects on top
+	void forwardAfterDeferred(Scene& scene);
+	// Deferred lighting in a compute shader, only shading the lights overlapping each screen tile
+	void tiledDeferred(Scene& scene, const std::vector<unsigned int>& visibleItems);
 
 	// Forward rendering
-	void forward(Scene& scene);
+	void forward(Scene& scene, const std::vector<unsigned int>& visibleItems);
 
 	// Setup for post-processing screen quad
 	void setupPostProcResources();
@@ -0,0 +1,151 @@
+#include "renderthread.h"
+
+#include "imgui/imgui_impl_opengl3.h"
+
+#include <chrono>
+#include <iostream>
+
+namespace {
+	// Spin briefly before sleeping, a frame is usually handed over within a few microseconds
+	void backoff(unsigned int& spins) {
+		if (spins++ < 64) {
+			std::this_thread::yield();
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+}
+
+RenderThread::RenderThread(GLFWwindow* window, int width, int height) : window(window), width(width), height(height), running(false), ready(false) {
+	for (FramePacket& packet : packets) {
+		freePackets.push(&packet);
+	}
+}
+
+RenderThread::~RenderThread() {
+	this->stop();
+}
+
+bool RenderThread::start() {
+	running = true;
+	thread = std::thread(&RenderThread::run, this);
+
+	unsigned int spins = 0;
+	while (!ready) {
+		backoff(spins);
+	}
+	return initialized;
+}
+
+void RenderThread::stop() {
+	if (!thread.joinable())
+		return;
+
+	running = false;
+	thread.join();
+}
+
+const Scene& RenderThread::getScene() const {
+	return *scene;
+}
+
+FramePacket* RenderThread::acquirePacket() {
+	FramePacket* packet = nullptr;
+	unsigned int spins = 0;
+	while (!freePackets.pop(packet)) {
+		backoff(spins);
+	}
+	return packet;
+}
+
+void RenderThread::submitPacket(FramePacket* packet) {
+	// Can not fail, there are only as many packets as slots
+	submittedPackets.push(packet);
+}
+
+void RenderThread::run() {
+	glfwMakeContextCurrent(window);
+
+	int version = gladLoadGL(glfwGetProcAddress);
+	if (version == 0) {
+		printf("Failed to initialize OpenGL context\n");
+		glfwMakeContextCurrent(NULL);
+		ready = true;
+		return;
+	}
+
+	// Successfully loaded OpenGL
+	printf("Loaded OpenGL %d.%d\n", GLAD_VERSION_MAJOR(version), GLAD_VERSION_MINOR(version));
+	glViewport(0, 0, width, height);
+
+	// Create the imgui GL objects (font texture) before the main thread starts building frames
+	ImGui_ImplOpenGL3_Init();
+	ImGui_ImplOpenGL3_NewFrame();
+
+	// Scene generates cube and plane in constructor atm
+	scene = std::make_unique<Scene>(&camera);
+	// Renderer to specify forward/deferred rendering
+	renderer = std::make_unique<Renderer>(width, height, &camera);
+	// Other variants compile when settings first need them
+	renderer->warmUpShaders(*scene);
+
+	initialized = true;
+	ready = true;
+
+	while (running) {
+		FramePacket* packet = nullptr;
+		unsigned int spins = 0;
+		while (running && !submittedPackets.pop(packet)) {
+			backoff(spins);
+		}
+		if (!packet)
+			break;
+
+		this->renderFrame(*packet);
+		freePackets.push(packet);
+	}
+
+	renderer.reset();
+	scene.reset();
+	ImGui_ImplOpenGL3_Shutdown();
+	glfwMakeContextCurrent(NULL);
+}
+
+void RenderThread::renderFrame(FramePacket& packet) {
+	camera = packet.camera;
+
+	// The renderer's passes set the viewport from its own size
+	if (packet.width != width || packet.height != height) {
+		width = packet.width;
+		height = packet.height;
+		renderer->resize(width, height);
+	}
+
+	const RenderSettings& settings = packet.settings;
+	scene->setVisualizeNormals(settings.visualizeNormals);
+	scene->stanford_dragon->setMetallic(settings.metallic);
+	scene->stanford_dragon->setRoughness(settings.roughness);
+	scene->stanford_dragon->setAO(settings.ao);
+	scene->lightingManager.setPointLightPosition(0, settings.lightPosition);
+	scene->setNumTestLights(settings.numTestLights);
+	scene->lightingManager.setNumCascades(settings.numCascades);
+	scene->lightingManager.setShadowQuality(settings.shadowQuality);
+	scene->lightingManager.setPointShadowBudget(settings.pointShadowBudget);
+	renderer->setGamma(settings.gamma);
+	renderer->setExposure(settings.exposure);
+	renderer->setKernel(settings.kernel);
+	renderer->setLightHeatmap(settings.lightHeatmap);
+	renderer->setEnvironment(ENVIRONMENT_PATHS[settings.environment]);
+
+	// Render scene with current render type
+	Shader::resetUniformStats();
+	renderer->render(*scene, settings.renderType, packet.visibleItems);
+	packet.shadowStats = scene->lightingManager.getShadowUpdateStats();
+	packet.uniformStats = Shader::getUniformStats();
+
+	// Render Imgui
+	ImGui_ImplOpenGL3_RenderDrawData(packet.ui.getDrawData());
+
+	glfwSwapBuffers(window);
+}
@@ -0,0 +1,64 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <glad/gl.h>
+#include <GLFW/glfw3.h>
+
+#include "camera.h"
+#include "scene.h"
+#include "renderer.h"
+#include "framepacket.h"
+#include "spscqueue.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// Owns the GL context, scene and renderer. The main thread fills frame packets and the render
+// thread consumes them, with two packets the main thread can build the next frame while the
+// render thread submits the current one.
+class RenderThread {
+private:
+	static const unsigned int NUM_PACKETS = 2;
+
+	GLFWwindow* window;
+	int width, height;
+
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<bool> ready;
+	bool initialized = false;
+
+	FramePacket packets[NUM_PACKETS];
+	// main thread -> render thread
+	SpscQueue<FramePacket*, NUM_PACKETS> submittedPackets;
+	// render thread -> main thread
+	SpscQueue<FramePacket*, NUM_PACKETS> freePackets;
+
+	// Render thread copy of the camera, updated from every packet
+	Camera camera;
+	std::unique_ptr<Scene> scene;
+	std::unique_ptr<Renderer> renderer;
+
+public:
+	RenderThread(GLFWwindow* window, int width, int height);
+	~RenderThread();
+
+	// Starts the thread and blocks until GL and the scene are set up, returns false on failure
+	bool start();
+	void stop();
+
+	// Scene items are not modified after construction, so culling can read them from the main thread
+	const Scene& getScene() const;
+
+	// Blocks until the render thread released a packet
+	FramePacket* acquirePacket();
+	void submitPacket(FramePacket* packet);
+
+private:
+	void run();
+	void renderFrame(FramePacket& packet);
+};
+
+
+#endif
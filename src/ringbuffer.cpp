@@ -0,0 +1,101 @@
+#include "ringbuffer.h"
+
+#include <cstring>
+#include <iostream>
+
+FrameRingBuffer::FrameRingBuffer(size_t regionSize) {
+    int uniformAlignment = 0;
+    int storageAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+    alignment = (size_t)(uniformAlignment > storageAlignment ? uniformAlignment : storageAlignment);
+    this->allocate(regionSize);
+}
+
+void FrameRingBuffer::allocate(size_t regionSize) {
+    this->regionSize = (regionSize + alignment - 1) / alignment * alignment;
+
+    // Coherent so writes are visible without flushing, the fences take care of the ordering
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, this->regionSize * NUM_REGIONS, NULL, flags);
+    mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, this->regionSize * NUM_REGIONS, flags);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    if (!mapped)
+        std::cerr << "Frame ring buffer failed to be mapped" << std::endl;
+}
+
+FrameRingBuffer::~FrameRingBuffer() {
+    for (GLsync fence : fences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    for (const RetiredBuffer& retired : retiredBuffers)
+        glDeleteBuffers(1, &retired.buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+}
+
+void FrameRingBuffer::beginFrame() {
+    region = (region + 1) % NUM_REGIONS;
+    offset = 0;
+
+    GLsync& fence = fences[region];
+    if (fence) {
+        // Flush once so the fence is guaranteed to signal, then wait in 1 ms steps
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (result == GL_TIMEOUT_EXPIRED) {
+            result = glClientWaitSync(fence, 0, 1000000);
+        }
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    // After NUM_REGIONS frames the fence of the frame a buffer was replaced in has been waited for
+    for (size_t i = 0; i < retiredBuffers.size();) {
+        if (--retiredBuffers[i].framesLeft > 0) {
+            i++;
+            continue;
+        }
+        glDeleteBuffers(1, &retiredBuffers[i].buffer);
+        retiredBuffers[i] = retiredBuffers.back();
+        retiredBuffers.pop_back();
+    }
+}
+
+void FrameRingBuffer::endFrame() {
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+size_t FrameRingBuffer::write(const void* data, size_t size) {
+    size_t alignedSize = (size + alignment - 1) / alignment * alignment;
+    if (offset + alignedSize > regionSize) {
+        // Wrapping around would overwrite data of this frame the GPU hasn't read yet. Continue in a buffer with
+        // twice the region size instead, the old one keeps the data already bound
+        size_t newRegionSize = regionSize * 2 > offset + alignedSize ? regionSize * 2 : offset + alignedSize;
+        std::cerr << "Frame ring buffer region of " << regionSize << " bytes is full, growing it to " << newRegionSize << " bytes" << std::endl;
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        retiredBuffers.push_back({ buffer, NUM_REGIONS });
+        this->allocate(newRegionSize);
+        offset = 0;
+    }
+
+    size_t position = region * regionSize + offset;
+    std::memcpy(mapped + position, data, size);
+    offset += alignedSize;
+    return position;
+}
+
+void FrameRingBuffer::bindUniform(unsigned int binding, const void* data, size_t size) {
+    size_t position = this->write(data, size);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, position, size);
+}
+
+unsigned int FrameRingBuffer::getBuffer() const {
+    return buffer;
+}
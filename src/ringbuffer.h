@@ -0,0 +1,56 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <glad/gl.h> 
+
+#include <cstddef>
+#include <vector>
+
+// Persistently mapped buffer for data that changes every frame (camera, lights, per draw data).
+// Split into NUM_REGIONS frame regions that are written linearly, a fence per region keeps the
+// CPU from overwriting data the GPU still reads, so updates never cause implicit driver syncs.
+// A frame that needs more than a region moves the ring to a buffer with larger regions, the old
+// buffer stays alive until the GPU is done with the frames that used it.
+class FrameRingBuffer {
+private:
+    static const unsigned int NUM_REGIONS = 3;
+
+    unsigned int buffer;
+    unsigned char* mapped;
+    size_t regionSize;
+    // Offset alignment of glBindBufferRange for both uniform and storage buffers
+    size_t alignment;
+
+    unsigned int region = 0;
+    // Write position in the current region
+    size_t offset = 0;
+    GLsync fences[NUM_REGIONS] = {};
+
+    // Buffers replaced by a larger one, deleted once the region they were replaced in comes around again
+    struct RetiredBuffer {
+        unsigned int buffer;
+        unsigned int framesLeft;
+    };
+    std::vector<RetiredBuffer> retiredBuffers;
+
+    void allocate(size_t regionSize);
+
+public:
+    FrameRingBuffer(size_t regionSize);
+    ~FrameRingBuffer();
+
+    // Waits until the GPU is done with the next region, normally it already is
+    void beginFrame();
+    // Fences the region, call after the last command reading from it
+    void endFrame();
+
+    // Copies data into the current region, returns its offset in the buffer. The region grows if it is full,
+    // so the buffer may change with the write (getBuffer)
+    size_t write(const void* data, size_t size);
+    // Writes data and binds it to an indexed uniform buffer binding
+    void bindUniform(unsigned int binding, const void* data, size_t size);
+    unsigned int getBuffer() const;
+};
+
+
+#endif
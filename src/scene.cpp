@@ -1,4 +1,9 @@
 #include "scene.h"
+#include "jobsystem.h"
+#include "frustum.h"
+
+#include <cfloat>
+#include <random>
 
 Scene::Scene(Camera* camera) : camera(camera) {
     this->cube = std::unique_ptr<Mesh>(new DefaultCube());
@@ -9,24 +14,62 @@ Scene::Scene(Camera* camera) : camera(camera) {
     items.push_back({ glm::vec3(0.0f, 0.5f, -2.0f), glm::vec3(0.2f), cube.get() });
     items.push_back({ glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(10.0f), plane.get() });
     items.push_back({ glm::vec3(0.0f), glm::vec3(0.01f), stanford_dragon.get() });
+    // Meshes iterate over all their vertices, so compute the item bounds in parallel
+    JobSystem::instance().parallelFor(items.size(), 1, [this](unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            items[i].extents = items[i].mesh->computeBoundingBox(items[i].scale);
+        }
+    }, "computeItemBounds");
 
     // hardcoded lights
     lightingManager.setDirectionalLight(DirectionalLight(glm::vec3(0.0f, -4.0f, 0.0f), glm::vec3(0.05f), glm::vec3(1.0f), glm::vec3(0.5f)));
     lightingManager.addPointLight(PointLight(glm::vec3(0.5f, 0.25f, 0.875f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f, 25.0f));
     lightingManager.addPointLight(PointLight(glm::vec3(-4.0f, 1.0f, -4.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f, 25.0f));
     lightingManager.addPointLight(PointLight(glm::vec3(0.0f, 1.0f, -2.0f), glm::vec3(0.05f), glm::vec3(0.8f), glm::vec3(1.0f), 1.0f, 0.09f, 0.032f, 25.0f));
+    this->numSceneLights = lightingManager.getNumPointLights();
     // Setup GL UBO buffers
     lightingManager.setupGlBuffers();
 
+    // hardcoded reflection probes, a box over the plane and a sphere around the cube
+    reflectionProbes.addProbe({ glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(5.0f, 1.5f, 5.0f), 0.0f, 1.0f });
+    reflectionProbes.addProbe({ glm::vec3(0.0f, 0.75f, -2.0f), glm::vec3(0.0f), 1.5f, 0.5f });
+
+    if (Shader::isExtensionSupported("GL_ARB_shader_viewport_layer_array")) {
+        this->depthCubeMapLayeredShader = std::make_unique<Shader>("depthcubemap_layered.vert", "depthcubemap.frag");
+        glGenBuffers(1, &ssboShadowFaceDraws);
+    }
+    this->shadowFaceOffsets.resize(items.size());
+    this->shadowFaceCounts.resize(items.size());
+
     // currently not a dynamic scene so compute bounding box here
     this->bbox = this->computeBoundingBox();
+    this->sceneMin = glm::vec3(FLT_MAX);
+    this->sceneMax = glm::vec3(-FLT_MAX);
+    for (const SceneItem& item : items) {
+        sceneMin = glm::min(sceneMin, item.position - item.extents);
+        sceneMax = glm::max(sceneMax, item.position + item.extents);
+    }
 }
 
+Scene::~Scene() {
+    if (depthCubeMapLayeredShader)
+        glDeleteBuffers(1, &ssboShadowFaceDraws);
+}
+
+
+void Scene::warmUpShaders() {
+    lightCubeShader.submit();
+    depthMapShader.submit();
+    depthCubeMapShader.submit();
+    if (depthCubeMapLayeredShader)
+        depthCubeMapLayeredShader->submit();
+    depthParaboloidShader.submit();
+}
 
 void Scene::draw(Shader& shader) {
     //shader.use();
     for (const SceneItem& item : items) {
-        item.mesh->draw(shader, item.position, item.scale);
+        this->drawMesh(*item.mesh, shader, item.position, item.scale);
     }
 
     //// TRANSPARENT OBJECTS
@@ -45,11 +88,26 @@ void Scene::draw(Shader& shader) {
 }
 
 
+void Scene::draw(Shader& shader, const std::vector<unsigned int>& itemIndices) {
+    for (unsigned int idx : itemIndices) {
+        const SceneItem& item = items[idx];
+        this->drawMesh(*item.mesh, shader, item.position, item.scale);
+    }
+}
+
+
+void Scene::drawMesh(Mesh& mesh, Shader& shader, const glm::vec3& position, const glm::vec3& scale, unsigned int instanceCount) {
+    glm::mat4 model = mesh.getModelMatrix(position, scale);
+    frameData.bindUniform(7, &model, sizeof(glm::mat4));
+    mesh.draw(shader, instanceCount);
+}
+
+
 void Scene::specialShadersDraw() {
     // draw the lamp object
     lightCubeShader.use();
     for (unsigned int idx = 0; idx < lightingManager.getNumPointLights(); idx++) {
-        cube->draw(lightCubeShader, lightingManager.getPointLight(idx).position, glm::vec3(0.05f));
+        this->drawMesh(*cube, lightCubeShader, lightingManager.getPointLight(idx).position, glm::vec3(0.05f));
     }
 
     //// TRANSPARENT OBJECTS
@@ -70,51 +128,196 @@ void Scene::specialShadersDraw() {
     //normals
     if (visualize_normals) {
         normalsShader.use();
-        stanford_dragon->draw(normalsShader, glm::vec3(0.0f), glm::vec3(0.01));
+        this->drawMesh(*stanford_dragon, normalsShader, glm::vec3(0.0f), glm::vec3(0.01));
+    }
+}
+
+void Scene::setNumTestLights(unsigned int count) {
+    unsigned int current = lightingManager.getNumPointLights() - numSceneLights;
+    if (count < current) {
+        lightingManager.removePointLights(current - count);
+        return;
+    }
+
+    for (unsigned int i = current; i < count; i++) {
+        // seeded by index so the same lights come back after removing them
+        std::mt19937 rng(i);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        glm::vec3 position = glm::vec3((unit(rng) * 2.0f - 1.0f) * bbox.x, unit(rng) * 1.5f - 0.4f, (unit(rng) * 2.0f - 1.0f) * bbox.z);
+        glm::vec3 color = glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.5f;
+        // Cube shadows, the scene's meshes are too coarse for paraboloids (see PointShadowType)
+        lightingManager.addPointLight(PointLight(position, glm::vec3(0.0f), color, color, 1.0f, 0.7f, 8.0f, 25.0f), 256);
+    }
+}
+
+void Scene::bakeIrradianceVolume(const SHIrradiance& environment) {
+    std::vector<IrradianceVolumeInstance> instances;
+    for (const SceneItem& item : items) {
+        instances.push_back({ item.mesh, item.mesh->getModelMatrix(item.position, item.scale) });
     }
+    irradianceVolume.startBaking(instances, lightingManager, environment);
 }
 
 void Scene::bindLightsData(Shader& shader) {
-    lightingManager.bind(shader, this->bbox);
+    lightingManager.bind(shader);
 }
 
-void Scene::computeShadowMaps() {
-    lightingManager.configureMatrices(this->bbox);
+void Scene::computeShadowMaps(float aspectRatio) {
+    ShadowCamera shadowCamera = { camera->GetViewMatrix(), glm::radians(camera->Zoom), aspectRatio, NEAR_PLANE, FAR_PLANE };
+    lightingManager.update(sceneMin, sceneMax, shadowCamera, frameData);
 
-    // Compute directional light shadowmap
+    // Compute directional light cascades, each only draws the items inside its light frustum
+    const DirectionalLight& directionalLight = lightingManager.getDirectionalLight();
     depthMapShader.use();
-    lightingManager.bindDirectionalShadowMap();
-    this->draw(depthMapShader);
+    UniformHandle cascadeUniform = depthMapShader.getUniformHandle("cascade");
+    for (unsigned int cascade = 0; cascade < directionalLight.numCascades; cascade++) {
+        glm::vec4 planes[6];
+        extractFrustumPlanes(directionalLight.lightSpaceMatrices[cascade], planes);
+
+        depthMapShader.setInt(cascadeUniform, cascade);
+        lightingManager.bindDirectionalShadowMap(cascade);
+        for (const SceneItem& item : items) {
+            if (isBoxInFrustum(planes, item.position, item.extents))
+                this->drawMesh(*item.mesh, depthMapShader, item.position, item.scale);
+        }
+        lightingManager.releaseShadowMap();
+    }
+    lightingManager.filterShadowMoments();
+
+    // Compute point light shadowmaps, both kinds count towards the scheduler's budget
+    lightingManager.beginPointShadowUpdate();
+    this->computeParaboloidShadowMaps();
+    if (depthCubeMapLayeredShader) {
+        // All lights and faces in one instanced draw per item
+        this->computePointShadowDraws();
+        depthCubeMapLayeredShader->use();
+        UniformHandle drawOffsetUniform = depthCubeMapLayeredShader->getUniformHandle("drawOffset");
+        lightingManager.bindPointShadowMaps();
+        for (unsigned int i = 0; i < items.size(); i++) {
+            if (shadowFaceCounts[i] == 0)
+                continue;
+            depthCubeMapLayeredShader->setInt(drawOffsetUniform, shadowFaceOffsets[i]);
+            this->drawMesh(*items[i].mesh, *depthCubeMapLayeredShader, items[i].position, items[i].scale, shadowFaceCounts[i]);
+        }
+        lightingManager.releaseShadowMap();
+    }
+    else {
+        // Fallback, geometry shader draws every item to the 6 faces, one pass per light with a scheduled face
+        for (unsigned int i = 0; i < lightingManager.getNumPointLights(); i++) {
+            const PointLight& light = lightingManager.getPointLight(i);
+            if (light.shadowIndex < 0 || light.shadowType != POINT_SHADOW_CUBE || lightingManager.getScheduledShadowFaces(i) == 0)
+                continue;
+
+            depthCubeMapShader.use();
+            depthCubeMapShader.setInt("pointLightIdx", i);
+            lightingManager.bindPointShadowMap(i);
 
-    lightingManager.releaseShadowMap();
+            this->draw(depthCubeMapShader);
+
+            lightingManager.releaseShadowMap();
+        }
+    }
+    lightingManager.endPointShadowUpdate();
+}
 
-    // Compute point light shadowmaps
+void Scene::computeParaboloidShadowMaps() {
+    depthParaboloidShader.use();
+    UniformHandle pointLightIdxUniform = depthParaboloidShader.getUniformHandle("pointLightIdx");
+    UniformHandle hemisphereUniform = depthParaboloidShader.getUniformHandle("hemisphere");
     for (unsigned int i = 0; i < lightingManager.getNumPointLights(); i++) {
-        depthCubeMapShader.use();
-        depthCubeMapShader.setInt("pointLightIdx", i);
+        const PointLight& light = lightingManager.getPointLight(i);
+        unsigned char scheduledFaces = lightingManager.getScheduledShadowFaces(i);
+        if (light.shadowIndex < 0 || light.shadowType != POINT_SHADOW_PARABOLOID || scheduledFaces == 0)
+            continue;
 
-        lightingManager.bindPointShadowMap(i);
+        depthParaboloidShader.setInt(pointLightIdxUniform, i);
+        for (unsigned int hemisphere = 0; hemisphere < 2; hemisphere++) {
+            if (!(scheduledFaces & (1 << hemisphere)))
+                continue;
 
-        this->draw(depthCubeMapShader);
+            // Box around the half of the light's range in front of the hemisphere, like schedulePointShadows
+            glm::vec3 center = light.position + glm::vec3(0.0f, 0.0f, hemisphere == 0 ? 0.5f : -0.5f) * light.radius;
+            glm::vec3 extents = glm::vec3(light.radius, light.radius, 0.5f * light.radius);
+            depthParaboloidShader.setInt(hemisphereUniform, hemisphere);
+            lightingManager.bindParaboloidShadowMap(i, hemisphere);
+            for (const SceneItem& item : items) {
+                glm::vec3 distance = glm::abs(item.position - center);
+                if (distance.x <= item.extents.x + extents.x && distance.y <= item.extents.y + extents.y && distance.z <= item.extents.z + extents.z)
+                    this->drawMesh(*item.mesh, depthParaboloidShader, item.position, item.scale);
+            }
+            lightingManager.releaseShadowMap();
+        }
+    }
+}
 
-        lightingManager.releaseShadowMap();
+void Scene::computePointShadowDraws() {
+    const std::vector<PointLight>& lights = lightingManager.getPointLights();
+    const std::vector<PointLightShadow>& shadows = lightingManager.getPointLightShadows();
+
+    shadowFaceDraws.clear();
+    for (unsigned int i = 0; i < items.size(); i++) {
+        const SceneItem& item = items[i];
+        shadowFaceOffsets[i] = shadowFaceDraws.size();
+
+        for (unsigned int l = 0; l < lights.size(); l++) {
+            unsigned char scheduledFaces = lightingManager.getScheduledShadowFaces(l);
+            if (lights[l].shadowIndex < 0 || lights[l].shadowType != POINT_SHADOW_CUBE || scheduledFaces == 0)
+                continue;
+            // Item out of the light's range, it can't shadow anything lit
+            glm::vec3 closest = glm::clamp(lights[l].position, item.position - item.extents, item.position + item.extents);
+            if (glm::length(closest - lights[l].position) > lights[l].radius)
+                continue;
+
+            for (unsigned int face = 0; face < 6; face++) {
+                if (!(scheduledFaces & (1 << face)))
+                    continue;
+                glm::vec4 planes[6];
+                extractFrustumPlanes(shadows[l].shadowTransforms[face], planes);
+                if (isBoxInFrustum(planes, item.position, item.extents))
+                    shadowFaceDraws.push_back(l * 6 + face);
+            }
+        }
+        shadowFaceCounts[i] = shadowFaceDraws.size() - shadowFaceOffsets[i];
     }
+
+    // Grow by doubling, at least one entry so the buffer is never empty
+    unsigned int count = glm::max((unsigned int)shadowFaceDraws.size(), 1u);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboShadowFaceDraws);
+    if (count > shadowFaceDrawCapacity) {
+        shadowFaceDrawCapacity = glm::max(count, 2 * shadowFaceDrawCapacity);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, shadowFaceDrawCapacity * sizeof(unsigned int), NULL, GL_DYNAMIC_DRAW);
+    }
+    if (!shadowFaceDraws.empty())
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, shadowFaceDraws.size() * sizeof(unsigned int), shadowFaceDraws.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssboShadowFaceDraws);
 }
 
 glm::vec3 Scene::computeBoundingBox() {
     glm::vec3 bbox(0.0f);
     for (const SceneItem& item : items) {
-        glm::vec3 current_bbox = item.mesh->computeBoundingBox(item.scale);
-        bbox = glm::max(bbox, current_bbox);
+        bbox = glm::max(bbox, item.extents);
     }
     return bbox;
 }
 
+void Scene::cullItems(const glm::mat4& viewProjection, std::vector<unsigned int>& visibleItems) const {
+    glm::vec4 planes[6];
+    extractFrustumPlanes(viewProjection, planes);
+
+    visibleItems.clear();
+    for (unsigned int i = 0; i < items.size(); i++) {
+        if (isBoxInFrustum(planes, items[i].position, items[i].extents)) {
+            visibleItems.push_back(i);
+        }
+    }
+}
+
 
 void Scene::setVisualizeNormals(bool visualize_normals) {
     this->visualize_normals = visualize_normals;
 }
 
-unsigned int& Scene::getDepthCubemap(int index) {
+unsigned int Scene::getDepthCubemap(int index) {
     return lightingManager.getDepthCubemap(index);
 }
@@ -9,12 +9,20 @@
 #include "light.h"
 #include "mesh.h"
 #include "camera.h"
+#include "ringbuffer.h"
+#include "reflectionprobes.h"
+#include "irradiancevolume.h"
+
+// Bytes of per frame data (camera, lights, per draw) each of the ring's frame regions holds
+const size_t FRAME_DATA_REGION_SIZE = 1 << 20;
 
 struct SceneItem {
     glm::vec3 position;
     glm::vec3 scale;
     //glm::vec3 rotation;
     Mesh* mesh; // responsibility is on scene class to create the uniqueptr
+    // Half size of the axis aligned bounding box around position, used for culling
+    glm::vec3 extents;
 };
 
 class Scene {
@@ -23,14 +31,22 @@ private:
 public:
     //lights: dirlight, pointlight
     LightingManager lightingManager;
+    // Local reflections of the forward PBR path, captured by the renderer
+    ReflectionProbes reflectionProbes;
+    // Uniform data of the current frame, the renderer begins and ends the frames
+    FrameRingBuffer frameData = FrameRingBuffer(FRAME_DATA_REGION_SIZE);
 
     // unique meshes/models
     std::unique_ptr<Mesh> cube;
     std::unique_ptr<Mesh> plane;
     std::unique_ptr<Mesh> stanford_dragon;
+    // Baked indirect diffuse of the forward PBR path, after the meshes so it is destroyed before them
+    IrradianceVolume irradianceVolume;
 private:
     // Bounding box (max x, max y, max z)
     glm::vec3 bbox;
+    // World space bounds of all items
+    glm::vec3 sceneMin, sceneMax;
     
     // Objects in the scene to draw
     std::vector<SceneItem> items;
@@ -40,23 +56,55 @@ private:
     Shader normalsShader = Shader("normals.vert", "normals.geom", "normals.frag");
     Shader depthMapShader = Shader("depthmap.vert", "depthmap.frag");
     Shader depthCubeMapShader = Shader("depthcubemap.vert", "depthcubemap.geom", "depthcubemap.frag");
+    // Single pass point shadows, only created when ARB_shader_viewport_layer_array is supported
+    std::unique_ptr<Shader> depthCubeMapLayeredShader;
+    Shader depthParaboloidShader = Shader("depthparaboloid.vert", "depthcubemap.frag");
+
+    // (point light * 6 + face) pairs each item is drawn into, per item offset and count into the list
+    std::vector<unsigned int> shadowFaceDraws;
+    std::vector<unsigned int> shadowFaceOffsets;
+    std::vector<unsigned int> shadowFaceCounts;
+    unsigned int ssboShadowFaceDraws;
+    unsigned int shadowFaceDrawCapacity = 0;
     
     bool visualize_normals = false;
 
+    // Lights of the hardcoded scene, test lights are added after them
+    unsigned int numSceneLights;
+
+    // Writes the model matrix as per draw data (uniform binding 7) and draws
+    void drawMesh(Mesh& mesh, Shader& shader, const glm::vec3& position, const glm::vec3& scale, unsigned int instanceCount = 1);
+
 
 public:
     Scene(Camera* camera);
+    ~Scene();
 
+    // Starts compiling the scene's shaders, see Shader::submit
+    void warmUpShaders();
     void draw(Shader& shader);
+    // Draw only the given item indices, e.g. result of cullItems
+    void draw(Shader& shader, const std::vector<unsigned int>& itemIndices);
     // Special shaders for specific objects different from standard lighting
     void specialShadersDraw();
 
     void bindLightsData(Shader& shader);
-    void computeShadowMaps();
+    // aspectRatio of the camera the directional cascades are fitted to
+    void computeShadowMaps(float aspectRatio);
+    // Per face culling of the items against the shadowed point lights, fills and uploads the face draw lists
+    void computePointShadowDraws();
+    // Scheduled hemispheres of the dual paraboloid shadows, one pass each
+    void computeParaboloidShadowMaps();
     glm::vec3 computeBoundingBox();
+    // Frustum culling of the items, safe to call from another thread as items are not modified after construction
+    void cullItems(const glm::mat4& viewProjection, std::vector<unsigned int>& visibleItems) const;
+    // Bakes the irradiance volume in the background with the current lights, the environment lights the rays missing the scene
+    void bakeIrradianceVolume(const SHIrradiance& environment);
 
     void setVisualizeNormals(bool visualize_normals);
-    unsigned int& getDepthCubemap(int index);
+    // Adds or removes small randomly placed point lights after the scene lights, for testing light culling
+    void setNumTestLights(unsigned int count);
+    unsigned int getDepthCubemap(int index);
     
 };
 
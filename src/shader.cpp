@@ -1,85 +1,347 @@
 #include "shader.h"
+#include "hash.h"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/stat.h>
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath)
-{
-    //// 1. retrieve the vertex/fragment source code from filePath
-    //std::string vertexCode;
-    //std::string fragmentCode;
-    //std::ifstream vShaderFile;
-    //std::ifstream fShaderFile;
-    //// ensure ifstream objects can throw exceptions:
-    //vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    //fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    //try
-    //{
-    //    // open files
-    //    vShaderFile.open(vertexPath);
-    //    fShaderFile.open(fragmentPath);
-    //    std::stringstream vShaderStream, fShaderStream;
-    //    // read file's buffer contents into streams
-    //    vShaderStream << vShaderFile.rdbuf();
-    //    fShaderStream << fShaderFile.rdbuf();
-    //    // close file handlers
-    //    vShaderFile.close();
-    //    fShaderFile.close();
-    //    // convert stream into string
-    //    vertexCode = vShaderStream.str();
-    //    fragmentCode = fShaderStream.str();
-    //}
-    //catch (std::ifstream::failure& e)
-    //{
-    //    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
-    //}
-    //const char* vShaderCode = vertexCode.c_str();
-    //const char* fShaderCode = fragmentCode.c_str();
-    //// 2. compile shaders
-    //unsigned int vertex, fragment;
-    //// vertex shader
-    //vertex = glCreateShader(GL_VERTEX_SHADER);
-    //glShaderSource(vertex, 1, &vShaderCode, NULL);
-    //glCompileShader(vertex);
-    //checkCompileErrors(vertex, "VERTEX");
-    //// fragment Shader
-    //fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    //glShaderSource(fragment, 1, &fShaderCode, NULL);
-    //glCompileShader(fragment);
-    //checkCompileErrors(fragment, "FRAGMENT");
-    unsigned int vertex = this->createShader(vertexPath, ShaderType::VERTEX);
-    unsigned int fragment = this->createShader(fragmentPath, ShaderType::FRAGMENT);
-    // shader Program
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-    checkCompileErrors(ID, "PROGRAM");
-    // delete the shaders as they're linked into our program now and no longer necessary
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+// Same value as GL_COMPLETION_STATUS_ARB
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+UniformStats Shader::uniformStats;
+bool Shader::spirvNamesMissing = false;
+
+// Defines that are specialization constants of the SPIR-V modules, the ids match the constant_id layouts
+// of the shaders. Defines without a value are 1, "true" and "false" are 1 and 0
+struct SpecializationConstant {
+    const char* define;
+    GLuint id;
+};
+
+static const SpecializationConstant specializationConstants[] = {
+    { "SHADOW_FILTER_TAPS", 0 },
+    { "SHADOW_MOMENTS", 1 },
+    { "NO_POINT_SHADOWS", 2 },
+    { "NO_POINT_LIGHTS", 3 },
+    { "SAMPLE_COUNT", 4 }
+};
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines) : defines(defines)
+{
+    stages.push_back({ ShaderType::VERTEX, vertexPath });
+    stages.push_back({ ShaderType::FRAGMENT, fragmentPath });
+}
+
+Shader::Shader(const char* vertexPath, const char* geometryPath, const char* fragmentPath, const ShaderDefines& defines) : defines(defines) {
+    stages.push_back({ ShaderType::VERTEX, vertexPath });
+    stages.push_back({ ShaderType::GEOMETRY, geometryPath });
+    stages.push_back({ ShaderType::FRAGMENT, fragmentPath });
+}
+
+
+Shader::Shader(const char* computePath, const ShaderDefines& defines) : defines(defines) {
+    stages.push_back({ ShaderType::COMPUTE, computePath });
+}
+
+void Shader::submit()
+{
+    if (buildState != BuildState::NOT_SUBMITTED)
+        return;
+
+    std::vector<ShaderSource> sources;
+    // Precompiled modules skip the GLSL front end of the driver
+    fromSpirv = !spirvFailed && this->readSpirvSources(sources);
+    if (!fromSpirv) {
+        sources.clear();
+        this->readGlslSources(sources);
+    }
+    this->submitProgram(sources.data(), (unsigned int)sources.size());
+}
+
+void Shader::readGlslSources(std::vector<ShaderSource>& sources)
+{
+    for (const ShaderStage& stage : stages) {
+        std::vector<std::string> included;
+        ShaderSource source;
+        source.type = stage.type;
+        source.code = this->readSource(stage.path.c_str(), included);
+        // Defines have to follow the #version line
+        std::string defineLines;
+        for (const std::string& define : defines)
+            defineLines += "#define " + define + "\n";
+        size_t versionEnd = source.code.find('\n', source.code.find("#version"));
+        source.code.insert(versionEnd == std::string::npos ? 0 : versionEnd + 1, defineLines);
+        sources.push_back(source);
+    }
+}
+
+// Last modification of a file, 0 if it doesn't exist
+static time_t modificationTime(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+}
+
+// Ids of the OpDecorate SpecId instructions of a SPIR-V module
+static std::vector<GLuint> moduleSpecializationIds(const std::string& module)
+{
+    std::vector<GLuint> ids;
+    const unsigned int* words = (const unsigned int*)module.data();
+    size_t wordCount = module.size() / 4;
+    // Header of 5 words, every instruction starts with its word count and opcode
+    const unsigned int SPIRV_MAGIC = 0x07230203, OP_DECORATE = 71, DECORATION_SPEC_ID = 1;
+    if (wordCount < 5 || words[0] != SPIRV_MAGIC)
+        return ids;
+    for (size_t i = 5; i < wordCount;) {
+        unsigned int instructionWords = words[i] >> 16;
+        unsigned int opcode = words[i] & 0xFFFF;
+        if (instructionWords == 0 || i + instructionWords > wordCount)
+            break;
+        if (opcode == OP_DECORATE && instructionWords >= 4 && words[i + 2] == DECORATION_SPEC_ID)
+            ids.push_back(words[i + 3]);
+        i += instructionWords;
+    }
+    return ids;
+}
+
+bool Shader::readSpirvSources(std::vector<ShaderSource>& sources)
+{
+    if (spirvNamesMissing || !hasSpirv())
+        return false;
+
+    // Specialization constants of the defines, a define the modules can't express needs the GLSL sources
+    std::vector<GLuint> constantIds, constantValues;
+    for (const std::string& define : defines) {
+        size_t nameEnd = define.find(' ');
+        std::string name = define.substr(0, nameEnd);
+        std::string value = nameEnd == std::string::npos ? "" : define.substr(nameEnd + 1);
+        const SpecializationConstant* constant = nullptr;
+        for (const SpecializationConstant& specializationConstant : specializationConstants) {
+            if (name == specializationConstant.define)
+                constant = &specializationConstant;
+        }
+        if (!constant)
+            return false;
+        constantIds.push_back(constant->id);
+        constantValues.push_back(value.empty() || value == "true" ? 1 : value == "false" ? 0 : (GLuint)std::strtoul(value.c_str(), nullptr, 0));
+    }
+
+    for (const ShaderStage& stage : stages) {
+        std::string modulePath = spirv_path + stage.path + ".spv";
+        time_t moduleTime = modificationTime(modulePath);
+        if (moduleTime == 0)
+            return false;
+        // Sources edited since the last build
+        std::vector<std::string> included;
+        this->readSource(stage.path.c_str(), included);
+        included.push_back(stage.path);
+        for (const std::string& file : included) {
+            if (modificationTime(resources_path + file) > moduleTime)
+                return false;
+        }
+
+        std::ifstream file(modulePath, std::ios::binary);
+        std::stringstream module;
+        module << file.rdbuf();
+        ShaderSource source;
+        source.type = stage.type;
+        source.code = module.str();
+        source.spirv = true;
+        // Only the constants declared by this module, specializing others fails
+        std::vector<GLuint> moduleIds = moduleSpecializationIds(source.code);
+        for (size_t i = 0; i < constantIds.size(); i++) {
+            if (std::find(moduleIds.begin(), moduleIds.end(), constantIds[i]) != moduleIds.end()) {
+                source.constantIds.push_back(constantIds[i]);
+                source.constantValues.push_back(constantValues[i]);
+            }
+        }
+        sources.push_back(source);
+    }
+    return true;
 }
 
-Shader::Shader(const char* vertexPath, const char* geometryPath, const char* fragmentPath) {
-    unsigned int vertex = this->createShader(vertexPath, ShaderType::VERTEX);
-    unsigned int geometry = this->createShader(geometryPath, ShaderType::GEOMETRY);
-    unsigned int fragment = this->createShader(fragmentPath, ShaderType::FRAGMENT);
+bool Shader::hasSpirv()
+{
+    static bool supported = false;
+    static bool checked = false;
+    if (!checked) {
+        checked = true;
+        GLint numFormats = 0;
+        glGetIntegerv(GL_NUM_SHADER_BINARY_FORMATS, &numFormats);
+        std::vector<GLint> formats(numFormats);
+        if (numFormats > 0)
+            glGetIntegerv(GL_SHADER_BINARY_FORMATS, formats.data());
+        supported = glSpecializeShader != nullptr && std::find(formats.begin(), formats.end(), GL_SHADER_BINARY_FORMAT_SPIR_V) != formats.end();
+    }
+    return supported;
+}
+
+bool Shader::isReady()
+{
+    this->submit();
+    if (buildState == BuildState::COMPILING) {
+        // Without the extension the status queries of finish() would block anyway
+        if (hasParallelCompile()) {
+            GLint completed = GL_FALSE;
+            glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &completed);
+            if (!completed)
+                return false;
+        }
+        this->finish();
+    }
+    return true;
+}
+
+void Shader::build()
+{
+    this->submit();
+    if (buildState == BuildState::COMPILING)
+        this->finish();
+}
+
+bool Shader::hasParallelCompile()
+{
+    static const bool supported = isExtensionSupported("GL_KHR_parallel_shader_compile") || isExtensionSupported("GL_ARB_parallel_shader_compile");
+    return supported;
+}
+
+// Header of a program cache file, the binary follows it
+struct ProgramBinaryHeader {
+    unsigned int magic;
+    unsigned int format;
+    unsigned long long key;
+    unsigned int size;
+    unsigned int pad;
+};
+
+static const unsigned int PROGRAM_BINARY_MAGIC = 0x42505247;
+
+void Shader::submitProgram(const ShaderSource* sources, unsigned int count)
+{
+    // Binaries are only valid for the driver that produced them
+    unsigned long long key = HASH_SEED;
+    const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (GLenum driverString : driverStrings) {
+        const char* value = (const char*)glGetString(driverString);
+        key = hashBytes(key, value, std::strlen(value) + 1);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        key = hashBytes(key, &sources[i].type, sizeof(ShaderType));
+        key = hashBytes(key, sources[i].code.c_str(), sources[i].code.size() + 1);
+        key = hashBytes(key, sources[i].constantIds.data(), sources[i].constantIds.size() * sizeof(GLuint));
+        key = hashBytes(key, sources[i].constantValues.data(), sources[i].constantValues.size() * sizeof(GLuint));
+    }
+    char fileName[32];
+    std::snprintf(fileName, sizeof(fileName), "%016llx.bin", key);
+    cacheKey = key;
+    cachePath = program_cache_path + fileName;
+
     // shader Program
     ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, geometry);
-    glAttachShader(ID, fragment);
+    if (this->loadProgramBinary(cachePath, key)) {
+        this->reflect();
+        buildState = BuildState::READY;
+        return;
+    }
+
+    // Only queued here, errors are checked once the program is needed
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int shader = this->createShader(sources[i]);
+        glAttachShader(ID, shader);
+        pendingShaders.push_back({ sources[i].type, shader });
+    }
+    glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ID);
+    buildState = BuildState::COMPILING;
+}
+
+void Shader::finish()
+{
+    const char* typeNames[] = { "VERTEX", "FRAGMENT", "GEOMETRY", "COMPUTE" };
+    for (const std::pair<ShaderType, unsigned int>& shader : pendingShaders)
+        checkCompileErrors(shader.second, typeNames[(int)shader.first]);
     checkCompileErrors(ID, "PROGRAM");
     // delete the shaders as they're linked into our program now and no longer necessary
-    glDeleteShader(vertex);
-    glDeleteShader(geometry);
-    glDeleteShader(fragment);
+    for (const std::pair<ShaderType, unsigned int>& shader : pendingShaders) {
+        glDetachShader(ID, shader.second);
+        glDeleteShader(shader.second);
+    }
+    pendingShaders.clear();
+
+    if (fromSpirv) {
+        GLint linked = GL_FALSE, numUniforms = 0, maxNameLength = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+        glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_ACTIVE_RESOURCES, &numUniforms);
+        glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxNameLength);
+        // Names are optional in SPIR-V, without them the uniforms can't be found
+        if (numUniforms > 0 && maxNameLength <= 1)
+            spirvNamesMissing = true;
+        if (!linked || spirvNamesMissing) {
+            std::cerr << "SPIR-V modules of " << stages[0].path << " not usable, compiling the GLSL sources" << std::endl;
+            glDeleteProgram(ID);
+            ID = 0;
+            spirvFailed = true;
+            buildState = BuildState::NOT_SUBMITTED;
+            this->build();
+            return;
+        }
+    }
+
+    this->saveProgramBinary(cachePath, cacheKey);
+    this->reflect();
+    buildState = BuildState::READY;
+}
+
+bool Shader::loadProgramBinary(const std::string& path, unsigned long long key)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    ProgramBinaryHeader header;
+    if (!file.read((char*)&header, sizeof(header)) || header.magic != PROGRAM_BINARY_MAGIC || header.key != key)
+        return false;
+    std::vector<char> binary(header.size);
+    if (!file.read(binary.data(), header.size))
+        return false;
+
+    glProgramBinary(ID, header.format, binary.data(), header.size);
+    // Drivers reject binaries of other versions, the program is then compiled as usual
+    GLint success = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    return success == GL_TRUE;
 }
 
+void Shader::saveProgramBinary(const std::string& path, unsigned long long key)
+{
+    GLint success = 0, length = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+    // No binary formats supported
+    if (!success || length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(ID, length, NULL, &format, binary.data());
 
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Shader program cache could not be written: " << path << std::endl;
+        return;
+    }
+    ProgramBinaryHeader header = { PROGRAM_BINARY_MAGIC, format, key, (unsigned int)length, 0 };
+    file.write((const char*)&header, sizeof(header));
+    file.write(binary.data(), length);
+}
 
-unsigned int Shader::createShader(const char* file_path, ShaderType shader_type) {
+std::string Shader::readSource(const char* file_path, std::vector<std::string>& included) {
     std::string code;
     std::ifstream shader_file;
     // ensure ifstream objects can throw exceptions:
@@ -100,77 +362,290 @@ unsigned int Shader::createShader(const char* file_path, ShaderType shader_type)
     {
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
     }
-    const char* shader_code = code.c_str();
 
+    // Shared structs and functions, GLSL has no includes of its own
+    std::string expanded;
+    std::istringstream lines(code);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 10, "#include \"") == 0) {
+            std::string include = line.substr(10, line.find('"', 10) - 10);
+            if (std::find(included.begin(), included.end(), include) == included.end()) {
+                included.push_back(include);
+                expanded += this->readSource(include.c_str(), included);
+            }
+            continue;
+        }
+        // Declared for glslang in the offline build, the includes are expanded here
+        if (line.compare(0, 39, "#extension GL_GOOGLE_include_directive ") == 0)
+            continue;
+        expanded += line + "\n";
+    }
+    return expanded;
+}
+
+unsigned int Shader::createShader(const ShaderSource& source) {
     unsigned int shader;
-    switch (shader_type) {
+    switch (source.type) {
     case ShaderType::VERTEX:
         shader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(shader, 1, &shader_code, NULL);
-        glCompileShader(shader);
-        checkCompileErrors(shader, "VERTEX");
         break;
     case ShaderType::FRAGMENT:
         shader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(shader, 1, &shader_code, NULL);
-        glCompileShader(shader);
-        checkCompileErrors(shader, "FRAGMENT");
         break;
     case ShaderType::GEOMETRY:
         shader = glCreateShader(GL_GEOMETRY_SHADER);
-        glShaderSource(shader, 1, &shader_code, NULL);
-        glCompileShader(shader);
-        checkCompileErrors(shader, "GEOMETRY");
+        break;
+    case ShaderType::COMPUTE:
+        shader = glCreateShader(GL_COMPUTE_SHADER);
         break;
     default:
         std::cerr << "Shader type does not exist" << std::endl;
         throw std::exception("Shader type does not exist");
     }
 
+    if (source.spirv) {
+        // Specializing sets the compile status like glCompileShader does
+        glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, source.code.data(), (GLsizei)source.code.size());
+        glSpecializeShader(shader, "main", (GLuint)source.constantIds.size(), source.constantIds.data(), source.constantValues.data());
+    }
+    else {
+        const char* shader_code = source.code.c_str();
+        glShaderSource(shader, 1, &shader_code, NULL);
+        glCompileShader(shader);
+    }
     return shader;
 }
 
 void Shader::use()
 {
+    this->build();
     glUseProgram(ID);
 }
 
+// FNV-1a
+static unsigned int hashUniformName(const char* name)
+{
+    unsigned int hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void Shader::reflect()
+{
+    // Uniforms in the default block, the ones inside blocks have no location
+    GLint numUniforms = 0, maxNameLength = 0;
+    glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_ACTIVE_RESOURCES, &numUniforms);
+    glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxNameLength);
+    std::vector<char> name(glm::max(maxNameLength, 1));
+    const GLenum uniformProperties[] = { GL_BLOCK_INDEX, GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE };
+    for (GLint i = 0; i < numUniforms; i++) {
+        GLint values[4];
+        glGetProgramResourceiv(ID, GL_UNIFORM, i, 4, uniformProperties, 4, NULL, values);
+        if (values[0] != -1 || values[2] < 0)
+            continue;
+
+        glGetProgramResourceName(ID, GL_UNIFORM, i, (GLsizei)name.size(), NULL, name.data());
+        std::string uniformName(name.data());
+        this->addUniform(uniformName, values[2], values[1]);
+        // Arrays are reported as name[0], elements have consecutive locations
+        size_t arraySuffix = uniformName.rfind("[0]");
+        if (arraySuffix != std::string::npos && arraySuffix + 3 == uniformName.size()) {
+            std::string baseName = uniformName.substr(0, arraySuffix);
+            this->addUniform(baseName, values[2], values[1]);
+            for (GLint element = 1; element < values[3]; element++)
+                this->addUniform(baseName + "[" + std::to_string(element) + "]", values[2] + element, values[1]);
+        }
+    }
+
+    // Table at most half full so probing stays short
+    size_t tableSize = 1;
+    while (tableSize < 2 * uniforms.size())
+        tableSize *= 2;
+    uniformTable.assign(tableSize, -1);
+    for (int index = 0; index < (int)uniforms.size(); index++) {
+        size_t slot = uniforms[index].hash & (tableSize - 1);
+        while (uniformTable[slot] >= 0)
+            slot = (slot + 1) & (tableSize - 1);
+        uniformTable[slot] = index;
+    }
+
+    const GLenum blockInterfaces[] = { GL_UNIFORM_BLOCK, GL_SHADER_STORAGE_BLOCK };
+    const GLenum blockProperties[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+    for (GLenum programInterface : blockInterfaces) {
+        GLint numBlocks = 0;
+        glGetProgramInterfaceiv(ID, programInterface, GL_ACTIVE_RESOURCES, &numBlocks);
+        glGetProgramInterfaceiv(ID, programInterface, GL_MAX_NAME_LENGTH, &maxNameLength);
+        name.resize(glm::max(maxNameLength, 1));
+        for (GLint i = 0; i < numBlocks; i++) {
+            GLint values[2];
+            glGetProgramResourceiv(ID, programInterface, i, 2, blockProperties, 2, NULL, values);
+            glGetProgramResourceName(ID, programInterface, i, (GLsizei)name.size(), NULL, name.data());
+            blocks.push_back({ std::string(name.data()), programInterface, values[0], values[1] });
+        }
+    }
+}
+
+void Shader::addUniform(const std::string& name, int location, GLenum type)
+{
+    ReflectedUniform uniform;
+    uniform.name = name;
+    uniform.hash = hashUniformName(name.c_str());
+    uniform.location = location;
+    uniform.type = type;
+    uniforms.push_back(uniform);
+}
+
+UniformHandle Shader::getUniformHandle(const char* name)
+{
+    this->build();
+    UniformHandle handle;
+    unsigned int hash = hashUniformName(name);
+    size_t mask = uniformTable.size() - 1;
+    for (size_t slot = hash & mask; uniformTable[slot] >= 0; slot = (slot + 1) & mask) {
+        const ReflectedUniform& uniform = uniforms[uniformTable[slot]];
+        if (uniform.hash == hash && uniform.name == name) {
+            handle.index = uniformTable[slot];
+            return handle;
+        }
+    }
+    uniformStats.misses++;
+    return handle;
+}
+
+int Shader::getBlockBinding(const char* name)
+{
+    this->build();
+    for (const ReflectedBlock& block : blocks) {
+        if (block.name == name)
+            return block.binding;
+    }
+    return -1;
+}
+
+bool Shader::isExtensionSupported(const char* name)
+{
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; i++) {
+        if (std::strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    }
+    return false;
+}
+
 // utility uniform functions
     // ------------------------------------------------------------------------
-void Shader::setBool(const std::string& name, bool value) const
+void Shader::setBool(const char* name, bool value)
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    this->setInt(this->getUniformHandle(name), (int)value);
 }
 // ------------------------------------------------------------------------
-void Shader::setInt(const std::string& name, int value) const
+void Shader::setInt(const char* name, int value)
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    this->setInt(this->getUniformHandle(name), value);
 }
 // ------------------------------------------------------------------------
-void Shader::setFloat(const std::string& name, float value) const
+void Shader::setFloat(const char* name, float value)
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    this->setFloat(this->getUniformHandle(name), value);
 }
 // ------------------------------------------------------------------------
-void Shader::setVec3(const std::string& name, float x, float y, float z) const
+void Shader::setVec2(const char* name, const glm::vec2& value)
 {
-    glm::vec3 vec(x, y, z);
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(vec));
+    this->setVec2(this->getUniformHandle(name), value);
+}
+
+void Shader::setVec3(const char* name, float x, float y, float z)
+{
+    this->setVec3(this->getUniformHandle(name), glm::vec3(x, y, z));
 }
 // ------------------------------------------------------------------------
-void Shader::setVec3(const std::string& name, const glm::vec3& value) const
+void Shader::setVec3(const char* name, const glm::vec3& value)
 {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+    this->setVec3(this->getUniformHandle(name), value);
 }
 // ------------------------------------------------------------------------
-void Shader::setMat3(const std::string& name, const glm::mat3& value) const
+void Shader::setMat3(const char* name, const glm::mat3& value)
 {
-    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+    this->setMat3(this->getUniformHandle(name), value);
 }
 // ------------------------------------------------------------------------
-void Shader::setMat4(const std::string& name, const glm::mat4& value) const
+void Shader::setMat4(const char* name, const glm::mat4& value)
+{
+    this->setMat4(this->getUniformHandle(name), value);
+}
+
+// Pre-resolved uniforms
+// ------------------------------------------------------------------------
+void Shader::setBool(UniformHandle handle, bool value)
+{
+    this->setInt(handle, (int)value);
+}
+
+void Shader::setInt(UniformHandle handle, int value)
+{
+    if (this->updateCache(handle, &value, sizeof(int)))
+        glUniform1i(uniforms[handle.index].location, value);
+}
+
+void Shader::setFloat(UniformHandle handle, float value)
+{
+    if (this->updateCache(handle, &value, sizeof(float)))
+        glUniform1f(uniforms[handle.index].location, value);
+}
+
+void Shader::setVec2(UniformHandle handle, const glm::vec2& value)
+{
+    if (this->updateCache(handle, glm::value_ptr(value), sizeof(glm::vec2)))
+        glUniform2fv(uniforms[handle.index].location, 1, glm::value_ptr(value));
+}
+
+void Shader::setVec3(UniformHandle handle, const glm::vec3& value)
+{
+    if (this->updateCache(handle, glm::value_ptr(value), sizeof(glm::vec3)))
+        glUniform3fv(uniforms[handle.index].location, 1, glm::value_ptr(value));
+}
+
+void Shader::setMat3(UniformHandle handle, const glm::mat3& value)
+{
+    if (this->updateCache(handle, glm::value_ptr(value), sizeof(glm::mat3)))
+        glUniformMatrix3fv(uniforms[handle.index].location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setMat4(UniformHandle handle, const glm::mat4& value)
+{
+    if (this->updateCache(handle, glm::value_ptr(value), sizeof(glm::mat4)))
+        glUniformMatrix4fv(uniforms[handle.index].location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+bool Shader::updateCache(UniformHandle handle, const void* value, size_t size)
+{
+    if (handle.index < 0)
+        return false;
+
+    ReflectedUniform& uniform = uniforms[handle.index];
+    uniformStats.sets++;
+    if (uniform.cached && std::memcmp(uniform.value, value, size) == 0) {
+        uniformStats.redundantSets++;
+        return false;
+    }
+    std::memcpy(uniform.value, value, size);
+    uniform.cached = true;
+    return true;
+}
+
+const UniformStats& Shader::getUniformStats()
+{
+    return uniformStats;
+}
+
+void Shader::resetUniformStats()
 {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+    uniformStats = UniformStats();
 }
 
 
@@ -10,37 +10,169 @@
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
+
+// Pre-resolved uniform for the hot path, index into the shader's reflected uniforms
+struct UniformHandle {
+    int index = -1;
+};
+
+// Uniform updates of all shaders since the last reset
+struct UniformStats {
+    unsigned int sets = 0;
+    // Values equal to the last one set, no GL call was made
+    unsigned int redundantSets = 0;
+    // Names that are no active uniform of the shader
+    unsigned int misses = 0;
+};
+
+// Lines injected as #define after the #version line, e.g. "SHADOW_FILTER_TAPS 8".
+// For SPIR-V modules they are specialization constants instead, see specializationConstants in shader.cpp
+typedef std::vector<std::string> ShaderDefines;
 
 
 class Shader
 {
     const std::string resources_path = "../src/shaders/";
+    // Linked program binaries, keyed by the sources and the driver
+    const std::string program_cache_path = "../shader_cache/";
+    // SPIR-V modules built by the CompileSpirvShaders target of the project, named <stage file>.spv
+    const std::string spirv_path = "../shader_cache/spirv/";
 
     enum class ShaderType {
         VERTEX,
         FRAGMENT,
-        GEOMETRY
+        GEOMETRY,
+        COMPUTE
+    };
+
+    // GLSL code or a SPIR-V module with the values of its specialization constants
+    struct ShaderSource {
+        ShaderType type;
+        std::string code;
+        bool spirv = false;
+        std::vector<GLuint> constantIds;
+        std::vector<GLuint> constantValues;
+    };
+
+    struct ShaderStage {
+        ShaderType type;
+        std::string path;
     };
 
-    unsigned int createShader(const char* file_path, ShaderType shader_type);
+    enum class BuildState {
+        NOT_SUBMITTED,
+        // Compiling and linking on the driver's threads
+        COMPILING,
+        READY
+    };
+
+    // Compiled on first use
+    std::vector<ShaderStage> stages;
+    ShaderDefines defines;
+    BuildState buildState = BuildState::NOT_SUBMITTED;
+    // Stages of a program that is still compiling
+    std::vector<std::pair<ShaderType, unsigned int>> pendingShaders;
+    std::string cachePath;
+    unsigned long long cacheKey = 0;
+    // Built from the SPIR-V modules, falls back to the GLSL sources when they don't link
+    bool fromSpirv = false;
+    bool spirvFailed = false;
+    // Set once the driver drops the uniform names of a SPIR-V program, the setters look them up by name
+    static bool spirvNamesMissing;
+
+    // Active uniform outside of a block with the last value set
+    struct ReflectedUniform {
+        std::string name;
+        unsigned int hash;
+        int location;
+        GLenum type;
+        bool cached = false;
+        float value[16];
+    };
+
+    // Uniform or shader storage block
+    struct ReflectedBlock {
+        std::string name;
+        GLenum programInterface;
+        int binding;
+        int dataSize;
+    };
+
+    std::vector<ReflectedUniform> uniforms;
+    // Open addressing (linear probing) table of indices into uniforms, -1 is an empty slot
+    std::vector<int> uniformTable;
+    std::vector<ReflectedBlock> blocks;
+    static UniformStats uniformStats;
+
+    // Expands #include "file" (relative to the shaders folder), every file is included once
+    std::string readSource(const char* file_path, std::vector<std::string>& included);
+    // GLSL of every stage with the defines injected
+    void readGlslSources(std::vector<ShaderSource>& sources);
+    // Modules of every stage, false if one is missing or older than its sources or a define is no specialization constant
+    bool readSpirvSources(std::vector<ShaderSource>& sources);
+    // GL 4.6 or ARB_gl_spirv
+    static bool hasSpirv();
+    unsigned int createShader(const ShaderSource& source);
+    // Loads the program from the binary cache, otherwise starts compiling and linking without waiting
+    void submitProgram(const ShaderSource* sources, unsigned int count);
+    // Checks the compile and link results and caches the binary, blocks until the driver is done
+    void finish();
+    // GL_KHR_parallel_shader_compile (or the ARB version), completion can be polled without blocking
+    static bool hasParallelCompile();
+    bool loadProgramBinary(const std::string& path, unsigned long long key);
+    void saveProgramBinary(const std::string& path, unsigned long long key);
+    // Fills the uniform table and block list after linking
+    void reflect();
+    void addUniform(const std::string& name, int location, GLenum type);
+    // False if the value equals the cached one (or the handle is invalid), caches it otherwise
+    bool updateCache(UniformHandle handle, const void* value, size_t size);
 
 public:
-    // the program ID
-    unsigned int ID;
+    // the program ID, 0 until the shader is built
+    unsigned int ID = 0;
 
-    // constructor reads and builds the shader
-    Shader(const char* vertexPath, const char* fragmentPath);
-    Shader(const char* vertexPath, const char* geometryPath, const char* fragmentPath);
+    // constructor only stores the stages, the shader is built on first use
+    Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines = ShaderDefines());
+    Shader(const char* vertexPath, const char* geometryPath, const char* fragmentPath, const ShaderDefines& defines = ShaderDefines());
+    // compute shader program
+    Shader(const char* computePath, const ShaderDefines& defines = ShaderDefines());
+    // Starts compiling, with parallel compile support the driver does that on its own threads.
+    // Submit everything needed soon up front, so the compiles overlap
+    void submit();
+    // Submits if needed, true once the program can be used without waiting for the compiler
+    bool isReady();
+    // Waits until the program is built (or loads it from the binary cache)
+    void build();
     // use/activate the shader
     void use();
-    // utility uniform functions
-    void setBool(const std::string& name, bool value) const;
-    void setInt(const std::string& name, int value) const;
-    void setFloat(const std::string& name, float value) const;
-    void setVec3(const std::string& name, float x, float y, float z) const;
-    void setVec3(const std::string& name, const glm::vec3& value) const;
-    void setMat3(const std::string& name, const glm::mat3& value) const;
-    void setMat4(const std::string& name, const glm::mat4& value) const;
+    // Extension of the current context, for picking shaders with a fallback
+    static bool isExtensionSupported(const char* name);
+    // Hashed lookup in the reflected uniforms, setters ignore the invalid handle of an inactive uniform
+    UniformHandle getUniformHandle(const char* name);
+    // Binding point of a uniform or shader storage block, -1 if the program has no such block
+    int getBlockBinding(const char* name);
+    // utility uniform functions, names are looked up per call, handles skip the lookup.
+    // Values equal to the last one set are not sent again
+    void setBool(const char* name, bool value);
+    void setInt(const char* name, int value);
+    void setFloat(const char* name, float value);
+    void setVec2(const char* name, const glm::vec2& value);
+    void setVec3(const char* name, float x, float y, float z);
+    void setVec3(const char* name, const glm::vec3& value);
+    void setMat3(const char* name, const glm::mat3& value);
+    void setMat4(const char* name, const glm::mat4& value);
+    void setBool(UniformHandle handle, bool value);
+    void setInt(UniformHandle handle, int value);
+    void setFloat(UniformHandle handle, float value);
+    void setVec2(UniformHandle handle, const glm::vec2& value);
+    void setVec3(UniformHandle handle, const glm::vec3& value);
+    void setMat3(UniformHandle handle, const glm::mat3& value);
+    void setMat4(UniformHandle handle, const glm::mat4& value);
+
+    // Counted on the render thread, reset once per frame
+    static const UniformStats& getUniformStats();
+    static void resetUniformStats();
 private:
     void checkCompileErrors(unsigned int shader, std::string type);
 };
@@ -1,11 +1,11 @@
 #version 460 core
+#extension GL_GOOGLE_include_directive : require
 out vec4 FragColor;
 
 in VERT_OUT {
     vec3 FragPos; 
     vec3 Normal;
     vec2 TexCoords;
-    vec4 FragPosLightSpace;
 } frag_in;
 
 
@@ -15,108 +15,18 @@ struct Material {
     float shininess;
 }; 
 
-struct DirLight {
-    vec3 direction;
-    float pad1;
-    vec3 ambient;
-    float pad2;
-    vec3 diffuse;
-    float pad3;
-    vec3 specular;
-    float pad4;
-    mat4 lightSpaceMatrix;
-};
-
-struct PointLight {    
-    vec3 position;
-    float constant;
-    vec3 ambient;
-    float linear;
-    vec3 diffuse;
-    float quadratic;
-    vec3 specular;
-    float far;
-    mat4 shadowTransforms[6];
-};
+#include "lights.glsl"
 
-#define NR_POINT_LIGHTS 3  
-layout (std140, binding = 1) uniform Lights 
+layout (std140, binding = 0) uniform Matrices
 {
-    DirLight dirLight;
-    PointLight pointLights[NR_POINT_LIGHTS];
+    mat4 projection;
+    mat4 view;
 };
 
 
 uniform Material material;
 uniform vec3 viewPos;
-// Directional light shadowmap
-uniform sampler2D depthMap;
-// Point light shadowmaps
-uniform samplerCube cubeDepthMap[NR_POINT_LIGHTS];
-
-
-float DirLightShadowCalculation(vec4 fragPosLightSpace)
-{
-    // perform perspective divide
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    // transform to NDC
-    projCoords = projCoords * 0.5 + 0.5; 
-    float currentDepth = projCoords.z; 
-    float bias = 0.005;
-    // Simple Percentage-Closer Filtering 
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / textureSize(depthMap, 0);
-    for(int x = -1; x <= 1; ++x)
-    {
-        for(int y = -1; y <= 1; ++y)
-        {
-            float pcfDepth = texture(depthMap, projCoords.xy + vec2(x, y) * texelSize).r; 
-            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;        
-        }    
-    }
-    shadow /= 9.0;
-
-    if(projCoords.z > 1.0)
-        shadow = 0.0;
-
-    return shadow;
-}
-
-
-// Uses omnidirectional shadowmap (cubemap)
-float PointLightShadowCalculation(vec3 fragPos, int pointLightIndex)
-{
-    vec3 fragToLight = fragPos - pointLights[pointLightIndex].position; 
-    float closestDepth = texture(cubeDepthMap[pointLightIndex], fragToLight).r;
-    closestDepth *= pointLights[pointLightIndex].far;
-    float currentDepth = length(fragToLight); 
-    float shadow  = 0.0;
-    float bias    = 0.005; 
-    float samples = 4.0;
-    float offset  = 0.1;
-    for(float x = -offset; x < offset; x += offset / (samples * 0.5))
-    {
-        for(float y = -offset; y < offset; y += offset / (samples * 0.5))
-        {
-            for(float z = -offset; z < offset; z += offset / (samples * 0.5))
-            {
-                float closestDepth = texture(cubeDepthMap[pointLightIndex], fragToLight + vec3(x, y, z)).r; 
-                closestDepth *= pointLights[pointLightIndex].far;   // undo mapping [0;1]
-                if(currentDepth - bias > closestDepth)
-                    shadow += 1.0;
-            }
-        }
-    }
-    shadow /= (samples * samples * samples);
-    return shadow;
-}
-
-vec3 testPointShadow(vec3 fragPos, int pointLightIndex) {
-    vec3 fragToLight = fragPos - pointLights[pointLightIndex].position; 
-    float closestDepth = texture(cubeDepthMap[pointLightIndex], fragToLight).r;
-    //closestDepth *= pointLights[pointLightIndex].far;
-    return vec3(closestDepth);
-}
+#include "shadows.glsl"
 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
 {
@@ -167,14 +77,16 @@ void main()
     vec3 viewDir = normalize(viewPos - frag_in.FragPos);
 
     // calculate shadow
-    float shadow = DirLightShadowCalculation(frag_in.FragPosLightSpace); 
+    float shadow = DirLightShadowCalculation(frag_in.FragPos); 
 
     // phase 1: Directional lighting
     vec3 result = CalcDirLight(dirLight, norm, viewDir, shadow);
-    // phase 2: Point lights
-    for(int i = 0; i < NR_POINT_LIGHTS; i++) {
-        float pointShadow = PointLightShadowCalculation(frag_in.FragPos, i);
-        result += CalcPointLight(pointLights[i], norm, frag_in.FragPos, viewDir, pointShadow);   
+    if (!NO_POINT_LIGHTS) {
+        // phase 2: Point lights
+        for(int i = 0; i < numPointLights; i++) {
+            float pointShadow = PointLightShadowCalculation(frag_in.FragPos, i);
+            result += CalcPointLight(pointLights[i], norm, frag_in.FragPos, viewDir, pointShadow);   
+        }
     }
          
     // phase 3: Spot light
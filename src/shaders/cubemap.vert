@@ -1,13 +0,0 @@
-#version 460 core
-layout (location = 0) in vec3 aPos;
-
-out vec3 localPos;
-
-uniform mat4 projection;
-uniform mat4 view;
-
-void main()
-{
-    localPos = aPos;  
-    gl_Position =  projection * view * vec4(localPos, 1.0);
-}
\ No newline at end of file
@@ -0,0 +1,16 @@
+// Direction through the center of a cube map texel, gl_GlobalInvocationID.z is the face.
+// Same face orientation as sampling a samplerCube
+vec3 CubeTexelDirection(ivec3 texel, int size)
+{
+    vec2 uv = (vec2(texel.xy) + 0.5) / float(size) * 2.0 - 1.0;
+    vec3 direction;
+    switch (texel.z) {
+    case 0: direction = vec3(1.0, -uv.y, -uv.x); break;
+    case 1: direction = vec3(-1.0, -uv.y, uv.x); break;
+    case 2: direction = vec3(uv.x, 1.0, uv.y); break;
+    case 3: direction = vec3(uv.x, -1.0, -uv.y); break;
+    case 4: direction = vec3(uv.x, -uv.y, 1.0); break;
+    default: direction = vec3(-uv.x, -uv.y, -1.0); break;
+    }
+    return normalize(direction);
+}
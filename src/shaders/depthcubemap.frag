@@ -1,46 +1,18 @@
 #version 460 core
+#extension GL_GOOGLE_include_directive : require
 in vec4 FragPos;
+// Set by the geometry shader or the layered vertex shader
+flat in int PointLightIdx;
 
-struct DirLight {
-    vec3 direction;
-    float pad1;
-    vec3 ambient;
-    float pad2;
-    vec3 diffuse;
-    float pad3;
-    vec3 specular;
-    float pad4;
-    mat4 lightSpaceMatrix;
-};
-
-struct PointLight {    
-    vec3 position;
-    float constant;
-    vec3 ambient;
-    float linear;
-    vec3 diffuse;
-    float quadratic;
-    vec3 specular;
-    float far;
-    mat4 shadowTransforms[6];
-};
-
-#define NR_POINT_LIGHTS 3  
-layout (std140, binding = 1) uniform Lights 
-{
-    DirLight dirLight;
-    PointLight pointLights[NR_POINT_LIGHTS];
-};
-
-uniform int pointLightIdx;
+#include "lights.glsl"
 
 //uniform vec3 lightPos;
 //uniform float far_plane;
 
 void main()
 {
-    vec3 lightPos = pointLights[pointLightIdx].position;
-    float farPlane = pointLights[pointLightIdx].far;
+    vec3 lightPos = pointLights[PointLightIdx].position;
+    float farPlane = pointLights[PointLightIdx].far;
     // get distance between fragment and light source
     float lightDistance = length(FragPos.xyz - lightPos);
     
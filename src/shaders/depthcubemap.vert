@@ -1,7 +1,10 @@
 #version 460 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 model;
+layout (std140, binding = 7) uniform DrawData
+{
+    mat4 model;
+};
 
 void main()
 {
@@ -0,0 +1,43 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : require
+// Writes gl_Layer and gl_ViewportIndex from the vertex shader, every instance is one (light, face) pair
+#extension GL_ARB_shader_viewport_layer_array : require
+layout (location = 0) in vec3 aPos;
+
+#include "lights.glsl"
+
+// 6 face matrices per point light
+layout (std430, binding = 3) readonly buffer PointLightShadows
+{
+    mat4 shadowTransforms[];
+};
+
+// (point light index * 6 + face) per instance, filled by Scene::computePointShadowDraws
+layout (std430, binding = 6) readonly buffer ShadowFaceDraws
+{
+    uint shadowFaceDraws[];
+};
+
+layout (std140, binding = 7) uniform DrawData
+{
+    mat4 model;
+};
+// First entry of this draw call in shadowFaceDraws
+uniform int drawOffset;
+
+out vec4 FragPos;
+flat out int PointLightIdx;
+
+void main()
+{
+    uint faceDraw = shadowFaceDraws[drawOffset + gl_InstanceID];
+    int pointLightIdx = int(faceDraw / 6u);
+    int face = int(faceDraw % 6u);
+
+    FragPos = model * vec4(aPos, 1.0);
+    PointLightIdx = pointLightIdx;
+    gl_Position = shadowTransforms[pointLightIdx * 6 + face] * FragPos;
+    // layer-face of the cube map array, the viewport of the layer has the light's shadow resolution
+    gl_Layer = pointLights[pointLightIdx].shadowIndex * 6 + face;
+    gl_ViewportIndex = pointLights[pointLightIdx].shadowIndex;
+}
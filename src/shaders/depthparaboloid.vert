@@ -0,0 +1,33 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : require
+// Dual paraboloid projection of one hemisphere around the point light, hemisphere 0 looks along +z
+layout (location = 0) in vec3 aPos;
+
+#include "lights.glsl"
+
+layout (std140, binding = 7) uniform DrawData
+{
+    mat4 model;
+};
+uniform int pointLightIdx;
+uniform int hemisphere;
+
+out vec4 FragPos;
+flat out int PointLightIdx;
+
+void main()
+{
+    FragPos = model * vec4(aPos, 1.0);
+    PointLightIdx = pointLightIdx;
+
+    vec3 v = FragPos.xyz - pointLights[pointLightIdx].position;
+    // Back hemisphere is mirrored in x and z, a rotation so the triangle winding stays the same
+    if (hemisphere == 1)
+        v = vec3(-v.x, v.y, -v.z);
+    float distance = length(v);
+    v /= distance;
+
+    // Other hemisphere is clipped, the fragment shader writes the exact distance as depth
+    gl_ClipDistance[0] = v.z;
+    gl_Position = vec4(v.xy / (1.0 + v.z), distance / pointLights[pointLightIdx].far * 2.0 - 1.0, 1.0);
+}
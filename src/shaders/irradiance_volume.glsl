@@ -0,0 +1,32 @@
+// Baked probe grid of IrradianceVolume::bind, include after sh_irradiance.glsl.
+// Texel (k * size.x + x, y, z) holds SH coefficient k of probe (x, y, z), so the 9 fetches filter trilinearly
+// between the probes without mixing coefficients
+layout (binding = 14) uniform sampler3D irradianceVolume;
+// Positions of the first and the last probe
+uniform vec3 irradianceVolumeMin;
+uniform vec3 irradianceVolumeMax;
+// Probes per axis, 0 until the first bake is done
+uniform vec3 irradianceVolumeSize;
+
+// Irradiance / PI like IrradianceSH, the environment's outside the volume with a fade over one probe spacing
+vec3 VolumeIrradiance(vec3 position, vec3 n)
+{
+    vec3 environment = IrradianceSH(n);
+    if (irradianceVolumeSize.x < 1.0)
+        return environment;
+
+    vec3 spacing = (irradianceVolumeMax - irradianceVolumeMin) / (irradianceVolumeSize - 1.0);
+    // Offset along the normal, so surfaces don't interpolate probes behind them
+    vec3 grid = (position + n * 0.25 * min(spacing.x, min(spacing.y, spacing.z)) - irradianceVolumeMin) / spacing;
+    vec3 outside = max(-grid, grid - (irradianceVolumeSize - 1.0));
+    float weight = clamp(1.0 - max(outside.x, max(outside.y, outside.z)), 0.0, 1.0);
+    if (weight <= 0.0)
+        return environment;
+
+    // Texel centers, clamped so filtering stays within a coefficient's block
+    vec3 uvw = (clamp(grid, vec3(0.0), irradianceVolumeSize - 1.0) + 0.5) / vec3(irradianceVolumeSize.x * 9.0, irradianceVolumeSize.yz);
+    vec3 sh[9];
+    for (int k = 0; k < 9; k++)
+        sh[k] = textureLod(irradianceVolume, uvw + vec3(float(k) / 9.0, 0.0, 0.0), 0.0).rgb;
+    return mix(environment, EvaluateIrradianceSH(sh, n), weight);
+}
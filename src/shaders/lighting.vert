@@ -7,7 +7,10 @@ layout (std140, binding = 0) uniform Matrices
     mat4 view;
 };
 
-uniform mat4 model;
+layout (std140, binding = 7) uniform DrawData
+{
+    mat4 model;
+};
 
 void main()
 {
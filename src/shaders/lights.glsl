@@ -0,0 +1,54 @@
+// Light structs and buffers shared by every shader reading the lights
+// matches MAX_CASCADES in light.h
+#define MAX_CASCADES 4
+
+// Specialization constant of the SPIR-V modules, an injected define when compiled from source
+#ifdef GL_SPIRV
+layout (constant_id = 3) const bool NO_POINT_LIGHTS = false;
+#elif !defined(NO_POINT_LIGHTS)
+#define NO_POINT_LIGHTS false
+#endif
+
+struct DirLight {
+    vec3 direction;
+    float pad1;
+    vec3 ambient;
+    float pad2;
+    vec3 diffuse;
+    float pad3;
+    vec3 specular;
+    float pad4;
+    mat4 lightSpaceMatrices[MAX_CASCADES];
+    vec4 shadowRects[MAX_CASCADES];
+    vec4 cascadeSplits;
+    uint numCascades;
+    float cascadeBlend;
+    vec2 pad5;
+};
+
+struct PointLight {
+    vec3 position;
+    float constant;
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+    float far;
+    float radius;
+    int shadowIndex;
+    float shadowScale;
+    // 0 cube map array, 1 dual paraboloid array
+    int shadowType;
+};
+
+layout (std140, binding = 1) uniform Lights
+{
+    DirLight dirLight;
+    uint numPointLights;
+};
+
+layout (std430, binding = 2) readonly buffer PointLights
+{
+    PointLight pointLights[];
+};
@@ -1,4 +1,5 @@
 #version 460 core
+#extension GL_GOOGLE_include_directive : require
 out vec4 FragColor;
 
 in VERT_OUT {
@@ -16,108 +17,43 @@ struct Material {
     float ao;
 };
 
-// lights
-struct DirLight {
-    vec3 direction;
-    float pad1;
-    vec3 ambient;
-    float pad2;
-    vec3 diffuse;
-    float pad3;
-    vec3 specular;
-    float pad4;
-    mat4 lightSpaceMatrix;
+#include "lights.glsl"
+
+layout (std140, binding = 0) uniform Matrices
+{
+    mat4 projection;
+    mat4 view;
 };
 
-struct PointLight {    
-    vec3 position;
-    float constant;
-    vec3 ambient;
-    float linear;
-    vec3 diffuse;
-    float quadratic;
-    vec3 specular;
-    float far;
-    mat4 shadowTransforms[6];
+// Lights per cluster, filled by ClusteredLights
+layout (std430, binding = 4) readonly buffer ClusterRanges
+{
+    uvec2 clusterRanges[]; // offset, count
 };
 
-#define NR_POINT_LIGHTS 3 
-layout (std140, binding = 1) uniform Lights 
+layout (std430, binding = 5) readonly buffer ClusterLightIndices
 {
-    DirLight dirLight;
-    PointLight pointLights[NR_POINT_LIGHTS];
+    uint clusterLightIndices[];
 };
 
+uniform vec3 clusterGridSize;
+// Pixels per cluster on screen
+uniform vec2 clusterTileSize;
+// Depth slice = log(view depth) * scale - bias
+uniform float clusterDepthScale;
+uniform float clusterDepthBias;
+
 const float PI = 3.14159265359;
 
 uniform Material material;
 uniform vec3 viewPos;
-uniform samplerCube irradianceMap;
 uniform samplerCube prefilterMap;
 uniform sampler2D brdfLUT;
 
-// Directional light shadowmap
-uniform sampler2D depthMap;
-// Point light shadowmaps
-uniform samplerCube cubeDepthMap[NR_POINT_LIGHTS];
-
-
-float DirLightShadowCalculation(vec3 fragPos)
-{
-    vec4 fragPosLightSpace = dirLight.lightSpaceMatrix * vec4(fragPos, 1.0);
-    // perform perspective divide
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    // transform to NDC
-    projCoords = projCoords * 0.5 + 0.5; 
-    float currentDepth = projCoords.z; 
-    float bias = 0.005;
-    // Simple Percentage-Closer Filtering 
-    float shadow = 0.0;
-    vec2 texelSize = 1.0 / textureSize(depthMap, 0);
-    for(int x = -1; x <= 1; ++x)
-    {
-        for(int y = -1; y <= 1; ++y)
-        {
-            float pcfDepth = texture(depthMap, projCoords.xy + vec2(x, y) * texelSize).r; 
-            shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;        
-        }    
-    }
-    shadow /= 9.0;
-
-    if(projCoords.z > 1.0)
-        shadow = 0.0;
-
-    return shadow;
-}
-
-
-// Uses omnidirectional shadowmap (cubemap)
-float PointLightShadowCalculation(vec3 fragPos, int pointLightIndex)
-{
-    vec3 fragToLight = fragPos - pointLights[pointLightIndex].position; 
-    float closestDepth = texture(cubeDepthMap[pointLightIndex], fragToLight).r;
-    closestDepth *= pointLights[pointLightIndex].far;
-    float currentDepth = length(fragToLight); 
-    float shadow  = 0.0;
-    float bias    = 0.005; 
-    float samples = 4.0;
-    float offset  = 0.1;
-    for(float x = -offset; x < offset; x += offset / (samples * 0.5))
-    {
-        for(float y = -offset; y < offset; y += offset / (samples * 0.5))
-        {
-            for(float z = -offset; z < offset; z += offset / (samples * 0.5))
-            {
-                float closestDepth = texture(cubeDepthMap[pointLightIndex], fragToLight + vec3(x, y, z)).r; 
-                closestDepth *= pointLights[pointLightIndex].far;   // undo mapping [0;1]
-                if(currentDepth - bias > closestDepth)
-                    shadow += 1.0;
-            }
-        }
-    }
-    shadow /= (samples * samples * samples);
-    return shadow;
-}
+#include "shadows.glsl"
+#include "sh_irradiance.glsl"
+#include "irradiance_volume.glsl"
+#include "reflection_probes.glsl"
   
 float DistributionGGX(vec3 N, vec3 H, float roughness) 
 {
@@ -165,6 +101,15 @@ vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
 } 
 
 
+uint ClusterIndex(vec3 fragPos)
+{
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    uint slice = uint(clamp(log(viewDepth) * clusterDepthScale - clusterDepthBias, 0.0, clusterGridSize.z - 1.0));
+    uvec2 tile = uvec2(min(gl_FragCoord.xy / clusterTileSize, clusterGridSize.xy - 1.0));
+    return tile.x + uint(clusterGridSize.x) * (tile.y + uint(clusterGridSize.y) * slice);
+}
+
+
 // Cook-terrance BRDF (expect normalized vectors)
 vec3 computeBRDF(vec3 F0, vec3 albedo, vec3 L, vec3 V, vec3 N) {
     vec3 H = normalize(V + L);
@@ -196,35 +141,45 @@ void main()
     // reflectance equation
     // Calc directional light reflectance
     vec3 dirL = normalize(-dirLight.direction);
-    vec3 Lo = computeBRDF(F0, albedo, dirL, V, N) * dirLight.diffuse * max(dot(N, dirL), 0.0);
+    float shadow = DirLightShadowCalculation(frag_in.FragPos);
+    vec3 Lo = computeBRDF(F0, albedo, dirL, V, N) * dirLight.diffuse * max(dot(N, dirL), 0.0) * (1.0 - shadow);
 
-    for(int i = 0; i < NR_POINT_LIGHTS; ++i) 
-    {
-        // calculate per-light radiance
-        vec3 L = normalize(pointLights[i].position - frag_in.FragPos);
-
-        float distance    = length(pointLights[i].position - frag_in.FragPos);
-        float attenuation = 1.0 / (distance * distance);
-        vec3 radiance     = pointLights[i].diffuse * attenuation;        
+    if (!NO_POINT_LIGHTS) {
+        // Only the lights assigned to this fragment's cluster
+        uvec2 cluster = clusterRanges[ClusterIndex(frag_in.FragPos)];
+        for(uint c = 0; c < cluster.y; ++c) 
+        {
+            uint i = clusterLightIndices[cluster.x + c];
+            // calculate per-light radiance
+            vec3 L = normalize(pointLights[i].position - frag_in.FragPos);
+
+            float distance    = length(pointLights[i].position - frag_in.FragPos);
+            float attenuation = 1.0 / (distance * distance);
+            // fade out towards the radius used for the cluster assignment
+            float window      = clamp(1.0 - pow(distance / pointLights[i].radius, 4.0), 0.0, 1.0);
+            attenuation      *= window * window;
+            float pointShadow = PointLightShadowCalculation(frag_in.FragPos, i);
+            vec3 radiance     = pointLights[i].diffuse * attenuation * (1.0 - pointShadow);
         
-        // cook-torrance brdf
-        vec3 brdf = computeBRDF(F0, albedo, L, V, N);
+            // cook-torrance brdf
+            vec3 brdf = computeBRDF(F0, albedo, L, V, N);
 
-        // add to outgoing radiance Lo
-        float NdotL = max(dot(N, L), 0.0);                
-        Lo += brdf * radiance * NdotL; 
-    }   
+            // add to outgoing radiance Lo
+            float NdotL = max(dot(N, L), 0.0);                
+            Lo += brdf * radiance * NdotL; 
+        }   
+    }
   
     vec3 F = fresnelSchlickRoughness(max(dot(N, V), 0.0), F0, material.roughness);
     vec3 kS = F;
     vec3 kD = 1.0 - kS;
     kD *= 1.0 - material.metallic;
 
-    vec3 irradiance = texture(irradianceMap, N).rgb;
+    vec3 irradiance = VolumeIrradiance(frag_in.FragPos, N);
     vec3 diffuse = irradiance * albedo;
     
     const float MAX_REFLECTION_LOD = 4.0;
-    vec3 prefilteredColor = textureLod(prefilterMap, R,  material.roughness * MAX_REFLECTION_LOD).rgb;   
+    vec3 prefilteredColor = ReflectionProbeRadiance(frag_in.FragPos, R, material.roughness * MAX_REFLECTION_LOD);
     vec2 envBRDF  = texture(brdfLUT, vec2(max(dot(N, V), 0.0), material.roughness)).rg;
     vec3 specular = prefilteredColor * (F * envBRDF.x + envBRDF.y);
 
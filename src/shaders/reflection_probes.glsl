@@ -0,0 +1,92 @@
+// Local reflection probes (ReflectionProbes::bind), include after the prefilterMap uniform.
+// Layout of GpuReflectionProbe, only probes with a prefiltered map are in the buffer
+struct ReflectionProbe {
+    vec4 positionRadius; // xyz position, w sphere radius (0 for a box)
+    vec4 extentsBlend;   // xyz box half size, w blend distance
+    int layer;           // cube map of the probe in reflectionProbeMaps
+};
+
+layout (std430, binding = 8) readonly buffer ReflectionProbes
+{
+    ReflectionProbe reflectionProbes[];
+};
+
+uniform int numReflectionProbes;
+// Same roughness levels as prefilterMap
+layout (binding = 13) uniform samplerCubeArray reflectionProbeMaps;
+
+// 1 inside the probe's volume less the blend distance, fading to 0 at its border
+float ProbeWeight(ReflectionProbe probe, vec3 position)
+{
+    vec3 local = position - probe.positionRadius.xyz;
+    float blend = probe.extentsBlend.w;
+    float outside;
+    if (probe.positionRadius.w > 0.0) {
+        outside = length(local) - (probe.positionRadius.w - blend);
+    }
+    else {
+        vec3 d = abs(local) - (probe.extentsBlend.xyz - blend);
+        outside = max(max(d.x, d.y), d.z);
+    }
+    return clamp(1.0 - outside / blend, 0.0, 1.0);
+}
+
+// Lookup direction of R from position, corrected for the captures being taken from the probe's center.
+// R is intersected with the probe's box or sphere, as if the reflected surroundings lay on it
+vec3 ProbeParallaxDirection(ReflectionProbe probe, vec3 position, vec3 R)
+{
+    vec3 center = probe.positionRadius.xyz;
+    float t;
+    if (probe.positionRadius.w > 0.0) {
+        vec3 oc = position - center;
+        float b = dot(oc, R);
+        float c = dot(oc, oc) - probe.positionRadius.w * probe.positionRadius.w;
+        t = -b + sqrt(max(b * b - c, 0.0));
+    }
+    else {
+        vec3 extents = probe.extentsBlend.xyz;
+        vec3 far = (center + extents - position) / R;
+        vec3 near = (center - extents - position) / R;
+        vec3 exits = max(far, near);
+        t = min(min(exits.x, exits.y), exits.z);
+    }
+    return position + R * max(t, 0.0) - center;
+}
+
+// Prefiltered radiance of the two most influential probes, the environment fills in where their weights
+// don't add up to 1
+vec3 ReflectionProbeRadiance(vec3 position, vec3 R, float lod)
+{
+    int first = -1, second = -1;
+    float firstWeight = 0.0, secondWeight = 0.0;
+    for (int i = 0; i < numReflectionProbes; i++) {
+        float weight = ProbeWeight(reflectionProbes[i], position);
+        if (weight > firstWeight) {
+            second = first;
+            secondWeight = firstWeight;
+            first = i;
+            firstWeight = weight;
+        }
+        else if (weight > secondWeight) {
+            second = i;
+            secondWeight = weight;
+        }
+    }
+
+    float total = firstWeight + secondWeight;
+    float scale = total > 1.0 ? 1.0 / total : 1.0;
+    vec3 radiance = vec3(0.0);
+    if (first >= 0) {
+        ReflectionProbe probe = reflectionProbes[first];
+        vec3 direction = ProbeParallaxDirection(probe, position, R);
+        radiance += textureLod(reflectionProbeMaps, vec4(direction, probe.layer), lod).rgb * firstWeight * scale;
+    }
+    if (second >= 0) {
+        ReflectionProbe probe = reflectionProbes[second];
+        vec3 direction = ProbeParallaxDirection(probe, position, R);
+        radiance += textureLod(reflectionProbeMaps, vec4(direction, probe.layer), lod).rgb * secondWeight * scale;
+    }
+    if (total < 1.0)
+        radiance += textureLod(prefilterMap, R, lod).rgb * (1.0 - total);
+    return radiance;
+}
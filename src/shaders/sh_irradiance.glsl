@@ -0,0 +1,24 @@
+// Diffuse irradiance of the environment as L2 spherical harmonics (IrradianceMap::setIrradianceSH),
+// convolved with the cosine lobe and divided by PI. Same basis order as sphericalharmonics.cpp
+uniform vec3 shIrradiance[9];
+
+// Coefficients in the layout of SHIrradiance, also used for the probes of irradiance_volume.glsl
+vec3 EvaluateIrradianceSH(vec3 sh[9], vec3 n)
+{
+    vec3 irradiance = sh[0] * 0.282095
+        + sh[1] * 0.488603 * n.y
+        + sh[2] * 0.488603 * n.z
+        + sh[3] * 0.488603 * n.x
+        + sh[4] * 1.092548 * n.x * n.y
+        + sh[5] * 1.092548 * n.y * n.z
+        + sh[6] * 0.315392 * (3.0 * n.y * n.y - 1.0)
+        + sh[7] * 1.092548 * n.x * n.z
+        + sh[8] * 0.546274 * (n.x * n.x - n.z * n.z);
+    // L2 ringing can go slightly negative opposite of bright lights
+    return max(irradiance, vec3(0.0));
+}
+
+vec3 IrradianceSH(vec3 n)
+{
+    return EvaluateIrradianceSH(shIrradiance, n);
+}
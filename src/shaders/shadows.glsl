@@ -0,0 +1,225 @@
+// Shadow lookups of the lighting shaders, include after lights.glsl and the Matrices block.
+// Variant constants (set by LightingManager::getShaderDefines), specialization constants of the SPIR-V modules
+// and injected defines when compiled from source:
+//   SHADOW_FILTER_TAPS  comparison taps per lookup, 1 is a single bilinear (2x2 PCF) tap, otherwise 4, 8 or 16 Poisson taps
+//   SHADOW_MOMENTS      EVSM tier, prefiltered moments for the cascades
+//   NO_POINT_SHADOWS    no point light has a shadowmap
+// SHADOW_COMPUTE is defined by compute shaders, no gl_FragCoord or derivatives
+#ifdef GL_SPIRV
+layout (constant_id = 0) const int SHADOW_FILTER_TAPS = 8;
+layout (constant_id = 1) const bool SHADOW_MOMENTS = false;
+layout (constant_id = 2) const bool NO_POINT_SHADOWS = false;
+#else
+#ifndef SHADOW_FILTER_TAPS
+#define SHADOW_FILTER_TAPS 8
+#endif
+#ifndef SHADOW_MOMENTS
+#define SHADOW_MOMENTS false
+#endif
+#ifndef NO_POINT_SHADOWS
+#define NO_POINT_SHADOWS false
+#endif
+#endif
+
+// Units match LightingManager::bind, samplers of branches a variant drops may stay active
+// Directional light shadowmap, dirLight.shadowRect is its part of the atlas
+layout (binding = 4) uniform sampler2DShadow shadowAtlas;
+// Point light shadows, layer PointLight.shadowIndex
+layout (binding = 5) uniform samplerCubeArrayShadow pointShadowMaps;
+// Dual paraboloid point light shadows, layers 2 * PointLight.shadowIndex (+z) and 2 * shadowIndex + 1 (-z)
+layout (binding = 7) uniform sampler2DArrayShadow paraboloidShadowMaps;
+// One layer per cascade
+layout (binding = 6) uniform sampler2DArray cascadeMoments;
+uniform vec2 shadowMomentExponents;
+
+// Lights with a lower shadow resolution only render to the corner [0, scale] of every face,
+// moves the lookup direction into that corner of the same face
+vec3 PointShadowDirection(vec3 v, float scale)
+{
+    vec3 a = abs(v);
+    if (a.x >= a.y && a.x >= a.z) {
+        // s = -sign(x) * z, t = -y
+        float s = -sign(v.x);
+        v.z = (v.z + s * a.x) * scale - s * a.x;
+        v.y = (v.y - a.x) * scale + a.x;
+    }
+    else if (a.y >= a.z) {
+        // s = x, t = sign(y) * z
+        float t = sign(v.y);
+        v.x = (v.x + a.y) * scale - a.y;
+        v.z = (v.z + t * a.y) * scale - t * a.y;
+    }
+    else {
+        // s = sign(z) * x, t = -y
+        float s = sign(v.z);
+        v.x = (v.x + s * a.z) * scale - s * a.z;
+        v.y = (v.y - a.z) * scale + a.z;
+    }
+    return v;
+}
+
+
+const vec2 poissonDisk[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725),
+    vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+    vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464),
+    vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+    vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420),
+    vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+    vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590),
+    vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790)
+);
+
+// Random rotation of the Poisson disk per pixel (interleaved gradient noise), turns banding into noise
+mat2 ShadowKernelRotation()
+{
+#ifdef SHADOW_COMPUTE
+    vec2 pixel = vec2(gl_GlobalInvocationID.xy);
+#else
+    vec2 pixel = gl_FragCoord.xy;
+#endif
+    float angle = 6.28318530718 * fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+    float s = sin(angle);
+    float c = cos(angle);
+    return mat2(c, s, -s, c);
+}
+
+// Probability that the depth is lit given the mean and variance of the filtered occluder depths
+float ChebyshevUpperBound(vec2 moments, float depth, float minVariance)
+{
+    if (depth <= moments.x)
+        return 1.0;
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    // Light bleeding reduction, cuts off the low tail of the bound
+    return clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+}
+
+// Single filtered fetch of the exponentially warped moments
+float CascadeMomentShadow(vec3 projCoords, int cascade)
+{
+#ifdef SHADOW_COMPUTE
+    // No derivatives in compute shaders, the blurred top level is used
+    vec4 moments = textureLod(cascadeMoments, vec3(projCoords.xy, cascade), 0.0);
+#else
+    vec4 moments = texture(cascadeMoments, vec3(projCoords.xy, cascade));
+#endif
+    float depth = projCoords.z * 2.0 - 1.0;
+    vec2 warpedDepth = vec2(exp(shadowMomentExponents.x * depth), -exp(-shadowMomentExponents.y * depth));
+    // Minimum variance scaled by the derivative of the warp
+    vec2 minVariance = 0.0001 * shadowMomentExponents * warpedDepth;
+    minVariance *= minVariance;
+    float positive = ChebyshevUpperBound(moments.xy, warpedDepth.x, minVariance.x);
+    float negative = ChebyshevUpperBound(moments.zw, warpedDepth.y, minVariance.y);
+    return 1.0 - min(positive, negative);
+}
+
+// Hardware comparison taps inside the cascade's rect of the atlas
+float CascadeShadowCalculation(vec3 fragPos, int cascade)
+{
+    vec4 fragPosLightSpace = dirLight.lightSpaceMatrices[cascade] * vec4(fragPos, 1.0);
+    // perform perspective divide
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    // transform to NDC
+    projCoords = projCoords * 0.5 + 0.5;
+    // Outside of the light's projection
+    if(projCoords.z > 1.0 || any(lessThan(projCoords.xy, vec2(0.0))) || any(greaterThan(projCoords.xy, vec2(1.0))))
+        return 0.0;
+    if (SHADOW_MOMENTS)
+        return CascadeMomentShadow(projCoords, cascade);
+
+    float bias = 0.005;
+    float reference = projCoords.z - bias;
+    vec2 texelSize = 1.0 / textureSize(shadowAtlas, 0);
+    // Keep the filter taps inside the cascade's rect of the atlas
+    vec4 shadowRect = dirLight.shadowRects[cascade];
+    vec2 atlasCoords = shadowRect.xy + projCoords.xy * shadowRect.zw;
+    vec2 rectMin = shadowRect.xy + 0.5 * texelSize;
+    vec2 rectMax = shadowRect.xy + shadowRect.zw - 0.5 * texelSize;
+    if (SHADOW_FILTER_TAPS <= 1)
+        return 1.0 - texture(shadowAtlas, vec3(clamp(atlasCoords, rectMin, rectMax), reference));
+
+    // Every tap is a bilinear 2x2 comparison itself, so a radius of a few texels is enough
+    mat2 rotation = ShadowKernelRotation();
+    float lit = 0.0;
+    for (int i = 0; i < SHADOW_FILTER_TAPS; i++)
+    {
+        vec2 offset = rotation * poissonDisk[i] * 2.0 * texelSize;
+        lit += texture(shadowAtlas, vec3(clamp(atlasCoords + offset, rectMin, rectMax), reference));
+    }
+    return 1.0 - lit / float(SHADOW_FILTER_TAPS);
+}
+
+// Cascade picked by view depth, fades into the next cascade at the end of each one
+float DirLightShadowCalculation(vec3 fragPos)
+{
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    int lastCascade = int(dirLight.numCascades) - 1;
+    int cascade = 0;
+    while (cascade < lastCascade && viewDepth > dirLight.cascadeSplits[cascade])
+        cascade++;
+    // Beyond the shadow distance
+    if (viewDepth > dirLight.cascadeSplits[cascade])
+        return 0.0;
+
+    float shadow = CascadeShadowCalculation(fragPos, cascade);
+    if (cascade < lastCascade) {
+        float cascadeStart = cascade == 0 ? 0.0 : dirLight.cascadeSplits[cascade - 1];
+        float blendStart = dirLight.cascadeSplits[cascade] - (dirLight.cascadeSplits[cascade] - cascadeStart) * dirLight.cascadeBlend;
+        float blend = smoothstep(blendStart, dirLight.cascadeSplits[cascade], viewDepth);
+        if (blend > 0.0)
+            shadow = mix(shadow, CascadeShadowCalculation(fragPos, cascade + 1), blend);
+    }
+    return shadow;
+}
+
+
+// One comparison tap of the light's cube or dual paraboloid shadow in the given direction
+float PointShadowTap(PointLight light, vec3 direction, float reference)
+{
+    if (light.shadowType == 0)
+        return texture(pointShadowMaps, vec4(PointShadowDirection(direction, light.shadowScale), light.shadowIndex), reference);
+
+    // The back hemisphere is mirrored in x and z, same as when rendering it
+    vec3 v = normalize(direction);
+    int hemisphere = v.z >= 0.0 ? 0 : 1;
+    if (hemisphere == 1)
+        v = vec3(-v.x, v.y, -v.z);
+    vec2 uv = (v.xy / (1.0 + v.z) * 0.5 + 0.5) * light.shadowScale;
+    return texture(paraboloidShadowMaps, vec4(uv, light.shadowIndex * 2 + hemisphere, reference));
+}
+
+// Uses omnidirectional shadowmap (cube or dual paraboloid), depth is stored as distance / far
+float PointLightShadowCalculation(vec3 fragPos, uint pointLightIndex)
+{
+    if (NO_POINT_SHADOWS)
+        return 0.0;
+
+    PointLight light = pointLights[pointLightIndex];
+    // Light without shadowmap
+    if (light.shadowIndex < 0)
+        return 0.0;
+
+    vec3 fragToLight = fragPos - light.position;
+    float currentDepth = length(fragToLight);
+    float bias = 0.005;
+    float reference = (currentDepth - bias) / light.far;
+    if (SHADOW_FILTER_TAPS <= 1)
+        return 1.0 - PointShadowTap(light, fragToLight, reference);
+
+    // Poisson disk on the plane perpendicular to the lookup direction, grows a little with distance
+    vec3 direction = fragToLight / currentDepth;
+    vec3 tangent = normalize(cross(direction, abs(direction.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 bitangent = cross(direction, tangent);
+    float diskRadius = 0.05 * (1.0 + currentDepth / light.far);
+    mat2 rotation = ShadowKernelRotation();
+    float lit = 0.0;
+    for (int i = 0; i < SHADOW_FILTER_TAPS; i++)
+    {
+        vec2 offset = rotation * poissonDisk[i] * diskRadius;
+        vec3 sampleDirection = fragToLight + tangent * offset.x + bitangent * offset.y;
+        lit += PointShadowTap(light, sampleDirection, reference);
+    }
+    return 1.0 - lit / float(SHADOW_FILTER_TAPS);
+}
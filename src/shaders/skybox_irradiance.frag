@@ -0,0 +1,13 @@
+#version 460 core
+#extension GL_GOOGLE_include_directive : require
+// Debug view of the spherical harmonics irradiance
+out vec4 FragColor;
+
+in vec3 TexCoords;
+
+#include "sh_irradiance.glsl"
+
+void main()
+{
+    FragColor = vec4(IrradianceSH(normalize(TexCoords)), 1.0);
+}
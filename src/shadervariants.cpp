@@ -0,0 +1,41 @@
+#include "shadervariants.h"
+
+ShaderVariants::ShaderVariants(const char* vertexPath, const char* fragmentPath) : vertexPath(vertexPath), fragmentPath(fragmentPath) {
+
+}
+
+ShaderVariants::ShaderVariants(const char* computePath) : computePath(computePath) {
+
+}
+
+Shader& ShaderVariants::get(const ShaderDefines& defines) {
+    Shader& shader = this->find(defines);
+    if (shader.isReady()) {
+        fallback = &shader;
+        return shader;
+    }
+    return fallback ? *fallback : shader;
+}
+
+Shader* ShaderVariants::getIfReady(const ShaderDefines& defines) {
+    Shader& shader = this->find(defines);
+    return shader.isReady() ? &shader : nullptr;
+}
+
+void ShaderVariants::warmUp(const std::vector<ShaderDefines>& variantDefines) {
+    for (const ShaderDefines& defines : variantDefines)
+        this->find(defines).submit();
+}
+
+Shader& ShaderVariants::find(const ShaderDefines& defines) {
+    for (auto& variant : variants) {
+        if (variant.first == defines)
+            return *variant.second;
+    }
+
+    std::unique_ptr<Shader> shader = computePath.empty()
+        ? std::make_unique<Shader>(vertexPath.c_str(), fragmentPath.c_str(), defines)
+        : std::make_unique<Shader>(computePath.c_str(), defines);
+    variants.emplace_back(defines, std::move(shader));
+    return *variants.back().second;
+}
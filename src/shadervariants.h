@@ -0,0 +1,38 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include "shader.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Specializations of one shader by their defines, each variant is compiled the first time it is used.
+// Variants are few, so they are found by comparing the defines instead of building a key every frame
+class ShaderVariants {
+private:
+    std::string vertexPath, fragmentPath, computePath;
+    std::vector<std::pair<ShaderDefines, std::unique_ptr<Shader>>> variants;
+    // Last variant that was ready, stands in while a requested variant is still compiling
+    Shader* fallback = nullptr;
+
+    // Creates the variant if it doesn't exist yet
+    Shader& find(const ShaderDefines& defines);
+
+public:
+    ShaderVariants(const char* vertexPath, const char* fragmentPath);
+    // compute shader variants
+    ShaderVariants(const char* computePath);
+
+    // The requested variant once it has finished compiling, until then the last ready variant.
+    // Only blocks when no variant is ready yet
+    Shader& get(const ShaderDefines& defines);
+    // The requested variant if it has finished compiling, otherwise nullptr and no stand-in. For passes where a
+    // different variant would give wrong results, doesn't change the fallback of get
+    Shader* getIfReady(const ShaderDefines& defines);
+    // Submits the variants for compiling now instead of on first use, for the ones needed right after startup
+    void warmUp(const std::vector<ShaderDefines>& variantDefines);
+};
+
+
+#endif
@@ -0,0 +1,271 @@
+#include "shadowatlas.h"
+
+#include <algorithm>
+#include <iostream>
+
+//// ShadowAtlas
+
+ShadowAtlas::ShadowAtlas(unsigned int size, unsigned int minSize) : size(size) {
+    for (unsigned int levelSize = size; levelSize >= minSize; levelSize /= 2) {
+        freeRects.push_back(std::vector<ShadowRect>());
+    }
+    freeRects[0].push_back({ 0, 0, size });
+
+    // Immutable storage, 16 bit depth is plenty for the orthographic and spot projections
+    glGenTextures(1, &depthTexture);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT16, size, size);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Shadow atlas framebuffer failed to be created/completed" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowAtlas::~ShadowAtlas() {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &depthTexture);
+}
+
+unsigned int ShadowAtlas::getLevel(unsigned int size) const {
+    unsigned int level = 0;
+    unsigned int levelSize = this->size;
+    while (levelSize / 2 >= size && level + 1 < freeRects.size()) {
+        levelSize /= 2;
+        level++;
+    }
+    return level;
+}
+
+bool ShadowAtlas::allocate(unsigned int size, ShadowRect& rect) {
+    unsigned int level = this->getLevel(size);
+
+    // Smallest free square that fits
+    int found = level;
+    while (found >= 0 && freeRects[found].empty()) {
+        found--;
+    }
+    if (found < 0)
+        return false;
+
+    // Split down to the requested level, keeping the first quadrant
+    ShadowRect current = freeRects[found].back();
+    freeRects[found].pop_back();
+    for (unsigned int l = found + 1; l <= level; l++) {
+        unsigned int half = current.size / 2;
+        freeRects[l].push_back({ current.x + half, current.y, half });
+        freeRects[l].push_back({ current.x, current.y + half, half });
+        freeRects[l].push_back({ current.x + half, current.y + half, half });
+        current.size = half;
+    }
+    rect = current;
+    return true;
+}
+
+void ShadowAtlas::free(const ShadowRect& rect) {
+    ShadowRect current = rect;
+    unsigned int level = this->getLevel(rect.size);
+
+    // Merge with the three buddies while they are all free
+    while (level > 0) {
+        unsigned int parentSize = current.size * 2;
+        unsigned int parentX = current.x / parentSize * parentSize;
+        unsigned int parentY = current.y / parentSize * parentSize;
+
+        std::vector<ShadowRect>& rects = freeRects[level];
+        auto isBuddy = [&](const ShadowRect& r) {
+            return r.x / parentSize * parentSize == parentX && r.y / parentSize * parentSize == parentY;
+        };
+        if (std::count_if(rects.begin(), rects.end(), isBuddy) != 3)
+            break;
+
+        rects.erase(std::remove_if(rects.begin(), rects.end(), isBuddy), rects.end());
+        current = { parentX, parentY, parentSize };
+        level--;
+    }
+    freeRects[level].push_back(current);
+}
+
+void ShadowAtlas::bindForRendering(const ShadowRect& rect) {
+    const float clearDepth = 1.0f;
+    glClearTexSubImage(depthTexture, 0, rect.x, rect.y, 0, rect.size, rect.size, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &clearDepth);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(rect.x, rect.y, rect.size, rect.size);
+}
+
+glm::vec4 ShadowAtlas::getUvRect(const ShadowRect& rect) const {
+    return glm::vec4(rect.x, rect.y, rect.size, rect.size) / (float)size;
+}
+
+unsigned int ShadowAtlas::getTexture() const {
+    return depthTexture;
+}
+
+
+//// ShadowCubeArray
+
+ShadowCubeArray::ShadowCubeArray(unsigned int size, unsigned int numLayers) : size(size), numLayers(numLayers) {
+    // Hand out the lowest layers first
+    for (int layer = numLayers - 1; layer >= 0; layer--) {
+        freeLayers.push_back(layer);
+    }
+
+    // Stores distance / far, 16 bit is enough for the shadow ranges used
+    glGenTextures(1, &depthTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, depthTexture);
+    glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 1, GL_DEPTH_COMPONENT16, size, size, numLayers * 6);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Shadow cube array framebuffer failed to be created/completed" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowCubeArray::~ShadowCubeArray() {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &depthTexture);
+    if (debugView != 0)
+        glDeleteTextures(1, &debugView);
+}
+
+int ShadowCubeArray::allocate() {
+    if (freeLayers.empty())
+        return -1;
+
+    int layer = freeLayers.back();
+    freeLayers.pop_back();
+    return layer;
+}
+
+void ShadowCubeArray::free(int layer) {
+    freeLayers.push_back(layer);
+}
+
+void ShadowCubeArray::bindForRendering(int layer, unsigned int resolution) {
+    this->clear(layer, resolution);
+    this->bind();
+    glViewport(0, 0, resolution, resolution);
+}
+
+void ShadowCubeArray::clear(int layer, unsigned int resolution, unsigned char faces) {
+    // Only the used corner of the faces
+    const float clearDepth = 1.0f;
+    if (faces == 0x3F) {
+        glClearTexSubImage(depthTexture, 0, 0, 0, layer * 6, resolution, resolution, 6, GL_DEPTH_COMPONENT, GL_FLOAT, &clearDepth);
+        return;
+    }
+    for (unsigned int face = 0; face < 6; face++) {
+        if (faces & (1 << face))
+            glClearTexSubImage(depthTexture, 0, 0, 0, layer * 6 + face, resolution, resolution, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &clearDepth);
+    }
+}
+
+void ShadowCubeArray::bind() {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+unsigned int ShadowCubeArray::getTexture() const {
+    return depthTexture;
+}
+
+unsigned int ShadowCubeArray::getSize() const {
+    return size;
+}
+
+unsigned int ShadowCubeArray::getCubeView(int layer) {
+    if (layer == debugViewLayer)
+        return debugView;
+
+    // Views can not be retargeted, so create a new one
+    if (debugView != 0)
+        glDeleteTextures(1, &debugView);
+    glGenTextures(1, &debugView);
+    glTextureView(debugView, GL_TEXTURE_CUBE_MAP, depthTexture, GL_DEPTH_COMPONENT16, 0, 1, layer * 6, 6);
+    debugViewLayer = layer;
+    return debugView;
+}
+
+
+//// ShadowParaboloidArray
+
+ShadowParaboloidArray::ShadowParaboloidArray(unsigned int size, unsigned int numShadows) : size(size), numShadows(numShadows) {
+    // Hand out the lowest layers first
+    for (int index = numShadows - 1; index >= 0; index--) {
+        freeShadows.push_back(index);
+    }
+
+    // Stores distance / far like the cube map array
+    glGenTextures(1, &depthTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT16, size, size, numShadows * 2);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "Shadow paraboloid array framebuffer failed to be created/completed" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+ShadowParaboloidArray::~ShadowParaboloidArray() {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &depthTexture);
+}
+
+int ShadowParaboloidArray::allocate() {
+    if (freeShadows.empty())
+        return -1;
+
+    int index = freeShadows.back();
+    freeShadows.pop_back();
+    return index;
+}
+
+void ShadowParaboloidArray::free(int index) {
+    freeShadows.push_back(index);
+}
+
+void ShadowParaboloidArray::bindForRendering(int index, unsigned int hemisphere, unsigned int resolution) {
+    unsigned int layer = index * 2 + hemisphere;
+    const float clearDepth = 1.0f;
+    glClearTexSubImage(depthTexture, 0, 0, 0, layer, resolution, resolution, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &clearDepth);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, layer);
+    glViewport(0, 0, resolution, resolution);
+}
+
+unsigned int ShadowParaboloidArray::getTexture() const {
+    return depthTexture;
+}
+
+unsigned int ShadowParaboloidArray::getSize() const {
+    return size;
+}
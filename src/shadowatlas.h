@@ -0,0 +1,106 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/gl.h> 
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Square region of the atlas in texels
+struct ShadowRect {
+    unsigned int x, y, size;
+};
+
+// One 16 bit depth texture shared by all 2D shadow maps (directional and spot lights).
+// Regions are power of two squares handed out by a quadtree (buddy) allocator.
+class ShadowAtlas {
+private:
+    unsigned int size;
+    unsigned int fbo;
+    unsigned int depthTexture;
+
+    // Free squares per level, level 0 is the whole atlas and every level halves the size
+    std::vector<std::vector<ShadowRect> > freeRects;
+
+public:
+    // minSize is the smallest region that can be allocated
+    ShadowAtlas(unsigned int size, unsigned int minSize);
+    ~ShadowAtlas();
+
+    // size is rounded up to a power of two, returns false when there is no space left
+    bool allocate(unsigned int size, ShadowRect& rect);
+    void free(const ShadowRect& rect);
+
+    // Render target limited to the rect, only the rect is cleared
+    void bindForRendering(const ShadowRect& rect);
+    // Offset (xy) and scale (zw) of the rect in texture coordinates
+    glm::vec4 getUvRect(const ShadowRect& rect) const;
+    unsigned int getTexture() const;
+
+private:
+    unsigned int getLevel(unsigned int size) const;
+};
+
+
+// Cube map array with a 16 bit depth cube per shadowed point light.
+// Lights can use a lower resolution by only rendering to the corner of their faces.
+class ShadowCubeArray {
+private:
+    unsigned int size;
+    unsigned int numLayers;
+    unsigned int fbo;
+    unsigned int depthTexture;
+
+    std::vector<int> freeLayers;
+
+    // Cube map view of a single layer for debugging
+    unsigned int debugView = 0;
+    int debugViewLayer = -1;
+
+public:
+    ShadowCubeArray(unsigned int size, unsigned int numLayers);
+    ~ShadowCubeArray();
+
+    // Returns -1 when all layers are in use
+    int allocate();
+    void free(int layer);
+
+    // All faces of the layer as layered render target (gl_Layer = layer * 6 + face)
+    void bindForRendering(int layer, unsigned int resolution);
+    // Clears the used corner of the faces of a layer, bit i of faces selects face i
+    void clear(int layer, unsigned int resolution, unsigned char faces = 0x3F);
+    // Whole array as layered render target, viewports are set by the caller
+    void bind();
+    unsigned int getTexture() const;
+    unsigned int getSize() const;
+    unsigned int getCubeView(int layer);
+};
+
+
+// 2D array with two 16 bit depth layers per dual paraboloid point light shadow,
+// layer 2 * index looks along +z and layer 2 * index + 1 along -z
+class ShadowParaboloidArray {
+private:
+    unsigned int size;
+    unsigned int numShadows;
+    unsigned int fbo;
+    unsigned int depthTexture;
+
+    std::vector<int> freeShadows;
+
+public:
+    ShadowParaboloidArray(unsigned int size, unsigned int numShadows);
+    ~ShadowParaboloidArray();
+
+    // Returns -1 when all shadows are in use
+    int allocate();
+    void free(int index);
+
+    // One hemisphere as render target, only the used corner is cleared
+    void bindForRendering(int index, unsigned int hemisphere, unsigned int resolution);
+    unsigned int getTexture() const;
+    unsigned int getSize() const;
+};
+
+
+#endif
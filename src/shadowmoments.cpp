@@ -0,0 +1,75 @@
+#include "shadowmoments.h"
+
+ShadowMoments::ShadowMoments(unsigned int size, unsigned int numLayers) : size(size), numLayers(numLayers) {
+    unsigned int levels = 1;
+    while ((size >> levels) > 0) {
+        levels++;
+    }
+
+    glGenTextures(1, &momentTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, momentTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA32F, size, size, numLayers);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    // Moments filter linearly, so anisotropic filtering is valid as well (core since 4.6)
+    float maxAnisotropy = 1.0f;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &maxAnisotropy);
+    glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY, glm::min(maxAnisotropy, 8.0f));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenTextures(1, &blurTexture);
+    glBindTexture(GL_TEXTURE_2D, blurTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, size, size);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    blurShader.use();
+    blurShader.setInt("shadowAtlas", 0);
+    blurShader.setInt("inputMoments", 1);
+    blurShader.setInt("blurRadius", SHADOW_MOMENT_BLUR_RADIUS);
+    blurShader.setVec2("exponents", glm::vec2(EVSM_POSITIVE_EXPONENT, EVSM_NEGATIVE_EXPONENT));
+}
+
+ShadowMoments::~ShadowMoments() {
+    glDeleteTextures(1, &momentTexture);
+    glDeleteTextures(1, &blurTexture);
+}
+
+void ShadowMoments::filter(const ShadowAtlas& atlas, const ShadowRect& rect, unsigned int layer) {
+    unsigned int resolution = glm::min(rect.size, size);
+    unsigned int groups = (resolution + 15) / 16;
+
+    blurShader.use();
+    blurShader.setVec3("atlasRect", glm::vec3(rect.x, rect.y, resolution));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas.getTexture());
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, blurTexture);
+
+    // Depth -> warped moments, blurred horizontally
+    blurShader.setBool("horizontal", true);
+    glBindImageTexture(0, blurTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glDispatchCompute(groups, groups, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    // Vertical pass into the layer
+    blurShader.setBool("horizontal", false);
+    glBindImageTexture(0, momentTexture, 0, GL_FALSE, layer, GL_WRITE_ONLY, GL_RGBA32F);
+    glDispatchCompute(groups, groups, 1);
+    // Next layer overwrites the blur texture that was just read
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void ShadowMoments::generateMipmaps() {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, momentTexture);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+unsigned int ShadowMoments::getTexture() const {
+    return momentTexture;
+}
@@ -0,0 +1,42 @@
+#ifndef SHADOW_MOMENTS_H
+#define SHADOW_MOMENTS_H
+
+#include <glad/gl.h> 
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "shadowatlas.h"
+
+// Exponential warp of the depth (EVSM), 32 bit floats overflow above ~42
+const float EVSM_POSITIVE_EXPONENT = 40.0f;
+const float EVSM_NEGATIVE_EXPONENT = 5.0f;
+// Taps on each side of the separable gaussian
+const int SHADOW_MOMENT_BLUR_RADIUS = 3;
+
+// Prefiltered exponential variance shadow maps, one array layer per shadow map.
+// Moments are resolved from the depth in the atlas and blurred by a separable compute pass,
+// after that they can be mipmapped and sampled with trilinear/anisotropic filtering.
+class ShadowMoments {
+private:
+    unsigned int size;
+    unsigned int numLayers;
+    // rgba32f (positive moment, its square, negative moment, its square)
+    unsigned int momentTexture;
+    // Result of the horizontal pass, reused for every layer
+    unsigned int blurTexture;
+
+    Shader blurShader = Shader("shadow_moments_blur.comp");
+
+public:
+    ShadowMoments(unsigned int size, unsigned int numLayers);
+    ~ShadowMoments();
+
+    // Resolve rect of the atlas (at most size) into layer
+    void filter(const ShadowAtlas& atlas, const ShadowRect& rect, unsigned int layer);
+    // Call after filtering all layers of the frame
+    void generateMipmaps();
+    unsigned int getTexture() const;
+};
+
+
+#endif
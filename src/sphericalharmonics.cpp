@@ -0,0 +1,211 @@
+#include "sphericalharmonics.h"
+#include "jobsystem.h"
+
+#include <cmath>
+#include <vector>
+#include <xmmintrin.h>
+
+// Real SH basis constants, y is the pole (Y20 ~ 3y^2 - 1, Y22 ~ x^2 - z^2)
+static const float SH_Y00 = 0.282095f;
+static const float SH_Y1 = 0.488603f;
+static const float SH_Y2 = 1.092548f;
+static const float SH_Y20 = 0.315392f;
+static const float SH_Y22 = 0.546274f;
+static const float PI = 3.14159265358979f;
+// Cosine lobe convolution per band (PI, 2PI/3, PI/4), divided by PI
+static const float SH_BAND_SCALES[SH_COEFFICIENT_COUNT] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+
+static float horizontalSum(__m128 v)
+{
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+IrradianceSHProjector::IrradianceSHProjector(unsigned int width, unsigned int height) :
+    width(width), height(height), cosPhi(width), sinPhi(width), rowSums(height * SH_COEFFICIENT_COUNT * 3)
+{
+    // Longitude only depends on the column, same mapping as SampleSphericalMap of equirect_to_cubemap.comp
+    for (unsigned int x = 0; x < width; x++) {
+        float phi = ((x + 0.5f) / width - 0.5f) * 2.0f * PI;
+        cosPhi[x] = std::cos(phi);
+        sinPhi[x] = std::sin(phi);
+    }
+}
+
+void IrradianceSHProjector::addRow(unsigned int y, const float* row)
+{
+    float latitude = ((y + 0.5f) / height - 0.5f) * PI;
+    float cosLatitude = std::cos(latitude);
+    float dirY = std::sin(latitude);
+    // Solid angle of the row's texels
+    float weight = (2.0f * PI / width) * (PI / height) * cosLatitude;
+
+    // Terms with y only are the same for the whole row
+    const __m128 basis0 = _mm_set1_ps(SH_Y00);
+    const __m128 basis1 = _mm_set1_ps(SH_Y1 * dirY);
+    const __m128 cosLat = _mm_set1_ps(cosLatitude);
+    const __m128 y1 = _mm_set1_ps(SH_Y1), y2 = _mm_set1_ps(SH_Y2), y22 = _mm_set1_ps(SH_Y22);
+    const __m128 dirY4 = _mm_set1_ps(dirY);
+    const __m128 basis6 = _mm_set1_ps(SH_Y20 * (3.0f * dirY * dirY - 1.0f));
+    __m128 sums[SH_COEFFICIENT_COUNT][3];
+    for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+        sums[k][0] = sums[k][1] = sums[k][2] = _mm_setzero_ps();
+
+    unsigned int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const float* p = row + x * 3;
+        __m128 color[3] = {
+            _mm_set_ps(p[9], p[6], p[3], p[0]),
+            _mm_set_ps(p[10], p[7], p[4], p[1]),
+            _mm_set_ps(p[11], p[8], p[5], p[2])
+        };
+        __m128 dirX = _mm_mul_ps(_mm_loadu_ps(&cosPhi[x]), cosLat);
+        __m128 dirZ = _mm_mul_ps(_mm_loadu_ps(&sinPhi[x]), cosLat);
+        // Basis in the order of sh_irradiance.glsl
+        __m128 basis[SH_COEFFICIENT_COUNT] = {
+            basis0,
+            basis1,
+            _mm_mul_ps(y1, dirZ),
+            _mm_mul_ps(y1, dirX),
+            _mm_mul_ps(y2, _mm_mul_ps(dirX, dirY4)),
+            _mm_mul_ps(y2, _mm_mul_ps(dirY4, dirZ)),
+            basis6,
+            _mm_mul_ps(y2, _mm_mul_ps(dirX, dirZ)),
+            _mm_mul_ps(y22, _mm_sub_ps(_mm_mul_ps(dirX, dirX), _mm_mul_ps(dirZ, dirZ)))
+        };
+        for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++) {
+            sums[k][0] = _mm_add_ps(sums[k][0], _mm_mul_ps(basis[k], color[0]));
+            sums[k][1] = _mm_add_ps(sums[k][1], _mm_mul_ps(basis[k], color[1]));
+            sums[k][2] = _mm_add_ps(sums[k][2], _mm_mul_ps(basis[k], color[2]));
+        }
+    }
+
+    float* rowSum = &rowSums[y * SH_COEFFICIENT_COUNT * 3];
+    for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++) {
+        for (unsigned int c = 0; c < 3; c++)
+            rowSum[k * 3 + c] = horizontalSum(sums[k][c]);
+    }
+    // Columns left over from the groups of 4
+    for (; x < width; x++) {
+        const float* p = row + x * 3;
+        float dirX = cosPhi[x] * cosLatitude;
+        float dirZ = sinPhi[x] * cosLatitude;
+        float basis[SH_COEFFICIENT_COUNT] = {
+            SH_Y00, SH_Y1 * dirY, SH_Y1 * dirZ, SH_Y1 * dirX,
+            SH_Y2 * dirX * dirY, SH_Y2 * dirY * dirZ, SH_Y20 * (3.0f * dirY * dirY - 1.0f),
+            SH_Y2 * dirX * dirZ, SH_Y22 * (dirX * dirX - dirZ * dirZ)
+        };
+        for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++) {
+            for (unsigned int c = 0; c < 3; c++)
+                rowSum[k * 3 + c] += basis[k] * p[c];
+        }
+    }
+    for (unsigned int i = 0; i < SH_COEFFICIENT_COUNT * 3; i++)
+        rowSum[i] *= weight;
+}
+
+SHIrradiance IrradianceSHProjector::getIrradiance() const
+{
+    double total[SH_COEFFICIENT_COUNT * 3] = {};
+    for (unsigned int y = 0; y < height; y++) {
+        for (unsigned int i = 0; i < SH_COEFFICIENT_COUNT * 3; i++)
+            total[i] += rowSums[y * SH_COEFFICIENT_COUNT * 3 + i];
+    }
+
+    SHIrradiance irradiance;
+    for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++) {
+        irradiance.coefficients[k] = glm::vec3(total[k * 3], total[k * 3 + 1], total[k * 3 + 2]) * SH_BAND_SCALES[k];
+    }
+    return irradiance;
+}
+
+SHIrradiance projectIrradianceSH(const float* pixels, unsigned int width, unsigned int height)
+{
+    IrradianceSHProjector projector(width, height);
+    JobSystem::instance().parallelFor(height, 16, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int y = begin; y < end; y++)
+            projector.addRow(y, pixels + (size_t)y * width * 3);
+    }, "projectIrradianceSH");
+    return projector.getIrradiance();
+}
+
+void evaluateSHBasis(const glm::vec3& d, float basis[SH_COEFFICIENT_COUNT])
+{
+    basis[0] = SH_Y00;
+    basis[1] = SH_Y1 * d.y;
+    basis[2] = SH_Y1 * d.z;
+    basis[3] = SH_Y1 * d.x;
+    basis[4] = SH_Y2 * d.x * d.y;
+    basis[5] = SH_Y2 * d.y * d.z;
+    basis[6] = SH_Y20 * (3.0f * d.y * d.y - 1.0f);
+    basis[7] = SH_Y2 * d.x * d.z;
+    basis[8] = SH_Y22 * (d.x * d.x - d.z * d.z);
+}
+
+SHIrradiance irradianceFromRadianceSH(const glm::vec3 radiance[SH_COEFFICIENT_COUNT])
+{
+    SHIrradiance irradiance;
+    for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+        irradiance.coefficients[k] = radiance[k] * SH_BAND_SCALES[k];
+    return irradiance;
+}
+
+glm::vec3 evaluateIrradianceSH(const SHIrradiance& irradiance, const glm::vec3& normal)
+{
+    float basis[SH_COEFFICIENT_COUNT];
+    evaluateSHBasis(normal, basis);
+    glm::vec3 result(0.0f);
+    for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+        result += irradiance.coefficients[k] * basis[k];
+    return glm::max(result, glm::vec3(0.0f));
+}
+
+glm::vec3 evaluateRadianceSH(const SHIrradiance& irradiance, const glm::vec3& direction)
+{
+    float basis[SH_COEFFICIENT_COUNT];
+    evaluateSHBasis(direction, basis);
+    glm::vec3 result(0.0f);
+    for (unsigned int k = 0; k < SH_COEFFICIENT_COUNT; k++)
+        result += irradiance.coefficients[k] * (basis[k] / SH_BAND_SCALES[k]);
+    // Not clamped: undoing the convolution brings back the ringing of band 2, and its negative lobes have to be
+    // projected again for the result to be the environment's irradiance. Clamping them made the bake's probes
+    // several times brighter facing away from a sun
+    return result;
+}
+
+bool checkSHRoundTrip()
+{
+    // Band limited test signal, a constant and the two zonal/sectoral band 2 terms with y as the pole
+    auto signal = [](const glm::vec3& d) {
+        return 1.0f + 0.2f * (3.0f * d.y * d.y - 1.0f) + 0.3f * (d.x * d.x - d.z * d.z);
+    };
+    const unsigned int width = 256, height = 128;
+    std::vector<float> pixels((size_t)width * height * 3);
+    for (unsigned int y = 0; y < height; y++) {
+        // Same mapping as IrradianceSHProjector::addRow
+        float latitude = ((y + 0.5f) / height - 0.5f) * PI;
+        for (unsigned int x = 0; x < width; x++) {
+            float phi = ((x + 0.5f) / width - 0.5f) * 2.0f * PI;
+            glm::vec3 d(std::cos(phi) * std::cos(latitude), std::sin(latitude), std::sin(phi) * std::cos(latitude));
+            float value = signal(d);
+            for (unsigned int c = 0; c < 3; c++)
+                pixels[((size_t)y * width + x) * 3 + c] = value;
+        }
+    }
+    SHIrradiance irradiance = projectIrradianceSH(pixels.data(), width, height);
+
+    const glm::vec3 directions[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+        glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f)), glm::normalize(glm::vec3(0.0f, -1.0f, 1.0f)), glm::normalize(glm::vec3(-1.0f, 0.5f, -0.25f))
+    };
+    for (const glm::vec3& d : directions) {
+        float expected = signal(d);
+        // Convolution scales band 2 by 1/4, the constant stays
+        float expectedIrradiance = 1.0f + 0.25f * (expected - 1.0f);
+        if (std::abs(evaluateRadianceSH(irradiance, d).x - expected) > 1e-2f
+            || std::abs(evaluateIrradianceSH(irradiance, d).x - expectedIrradiance) > 1e-2f)
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef SPHERICAL_HARMONICS_H
+#define SPHERICAL_HARMONICS_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Number of L2 coefficients, bands 0 to 2
+const unsigned int SH_COEFFICIENT_COUNT = 9;
+
+// Diffuse irradiance of an environment as L2 spherical harmonics, already convolved with the cosine lobe
+// and divided by PI, so evaluating the basis gives the value the irradiance cube map used to store.
+// Basis order and constants match sh_irradiance.glsl
+struct SHIrradiance {
+    glm::vec3 coefficients[SH_COEFFICIENT_COUNT];
+};
+
+// Projects an equirectangular image row by row, 4 pixels at a time with SSE. Rows can be added
+// in any order and from several threads, so the projection can run while the rows are decoded
+class IrradianceSHProjector {
+private:
+    unsigned int width, height;
+    std::vector<float> cosPhi, sinPhi;
+    // Per row sums, added up in order at the end so the result doesn't depend on the scheduling
+    std::vector<float> rowSums;
+public:
+    IrradianceSHProjector(unsigned int width, unsigned int height);
+
+    // RGB floats of row y, counted from the bottom (as loaded flipped for GL)
+    void addRow(unsigned int y, const float* row);
+    SHIrradiance getIrradiance() const;
+};
+
+// Projects a whole equirectangular RGB float image in parallel
+SHIrradiance projectIrradianceSH(const float* pixels, unsigned int width, unsigned int height);
+
+// Real SH basis of a unit direction, in the order of sh_irradiance.glsl
+void evaluateSHBasis(const glm::vec3& direction, float basis[SH_COEFFICIENT_COUNT]);
+// Convolves projected radiance (sums of radiance * basis * solid angle) with the cosine lobe
+SHIrradiance irradianceFromRadianceSH(const glm::vec3 radiance[SH_COEFFICIENT_COUNT]);
+// Irradiance / PI for a normal, like IrradianceSH of sh_irradiance.glsl
+glm::vec3 evaluateIrradianceSH(const SHIrradiance& irradiance, const glm::vec3& normal);
+// Band limited radiance in a direction, the irradiance with the convolution undone. Can be negative, only meant
+// for projecting it again (see IrradianceVolume)
+glm::vec3 evaluateRadianceSH(const SHIrradiance& irradiance, const glm::vec3& direction);
+
+// Projects a known band limited function and evaluates it again, false if the basis functions are inconsistent
+bool checkSHRoundTrip();
+
+
+#endif
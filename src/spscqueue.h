@@ -0,0 +1,49 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Lock-free bounded queue for exactly one producer thread and one consumer thread
+template <class T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0, "Queue needs at least one slot");
+
+    // One extra slot to distinguish full from empty
+    static constexpr size_t Size = Capacity + 1;
+    T slots[Size];
+
+    // Separate cache lines so producer and consumer do not invalidate each other
+    alignas(64) std::atomic<size_t> head{ 0 }; // consumer position
+    alignas(64) std::atomic<size_t> tail{ 0 }; // producer position
+public:
+    // Producer only, fails when full
+    bool push(const T& value) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        size_t nextTail = (currentTail + 1) % Size;
+        if (nextTail == head.load(std::memory_order_acquire))
+            return false;
+
+        slots[currentTail] = value;
+        tail.store(nextTail, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only, fails when empty
+    bool pop(T& value) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+            return false;
+
+        value = slots[currentHead];
+        head.store((currentHead + 1) % Size, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+
+#endif